@@ -1,6 +1,8 @@
 #include "dnx_buffer.h"
 
+#include "dnx_gem.h"
 #include "dnx_gpu.h"
+#include "dnx_trace.h"
 
 #include "nx_types.h"
 #include "nx_register_address.h"
@@ -47,6 +49,9 @@ void dnx_buffer_init(struct dnx_device *dnx)
 	struct dnx_ringbuf *buffer = dnx->buffer;
 
 	buffer->user_size = 0;
+	buffer->tail = 0;
+	buffer->wraps = 0;
+	buffer->tail_wraps = 0;
 
 	CMD_END(buffer);
 
@@ -55,12 +60,132 @@ void dnx_buffer_init(struct dnx_device *dnx)
 }
 
 
+/* The words between tail and head (user_size) may still be fetched by the
+ * STC. The region is never empty, as it always contains the last END. Job
+ * sections are reserved back to back and each one is contiguous, so the head
+ * may wrap around between two of them. */
+static bool dnx_buffer_fits(struct dnx_ringbuf *buffer, unsigned int nr_jobs)
+{
+	u32 bytes = DNX_BUFFER_JOB_DWORDS * sizeof(u32);
+	u32 head = buffer->user_size;
+	u32 tail = buffer->tail;
+
+	while(nr_jobs--) {
+		if(head >= tail) {
+			if(head + bytes > buffer->size) {
+				/* wrap around, keep head from catching up with tail */
+				if(bytes >= tail)
+					return false;
+				head = 0;
+			}
+		}
+		else if(head + bytes >= tail) {
+			return false;
+		}
+
+		head += bytes;
+	}
+
+	return true;
+}
+
+
+u32 dnx_buffer_space(struct dnx_ringbuf *buffer)
+{
+	if(buffer->user_size >= buffer->tail)
+		return buffer->size - buffer->user_size + buffer->tail;
+
+	return buffer->tail - buffer->user_size;
+}
+
+
+/* Moves the tail forward to pos in the lap of the given wraps. Positions the
+ * tail already passed are ignored, their words may have been reused. */
+static void dnx_buffer_move_tail(struct dnx_ringbuf *buffer, u32 wraps,
+		u32 pos)
+{
+	if(wraps == buffer->tail_wraps) {
+		if(pos <= buffer->tail)
+			return;
+	}
+	else if((s32)(wraps - buffer->tail_wraps) < 0) {
+		return;
+	}
+
+	buffer->tail = pos;
+	buffer->tail_wraps = wraps;
+}
+
+
+/* Moves the tail to the STC's fetch position if it is executing within the
+ * ring, i.e. it may already be beyond the sync of a job whose IRQ was not
+ * handled yet. */
+static void dnx_buffer_tail_from_stc(struct dnx_device *dnx,
+		struct dnx_ringbuf *buffer)
+{
+	u32 pos = dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS) - buffer->paddr;
+	u32 head = buffer->user_size;
+	u32 tail = buffer->tail;
+
+	if(pos >= buffer->size)
+		return;
+
+	pos &= ~(sizeof(u32) - 1);
+
+	if(tail <= head) {
+		if(pos < tail || pos >= head)
+			return;
+	}
+	else if(pos < tail && pos >= head) {
+		return;
+	}
+
+	/* behind the tail means in the head's lap */
+	dnx_buffer_move_tail(buffer, pos < tail ?
+			buffer->tail_wraps + 1 : buffer->tail_wraps, pos);
+}
+
+
+bool dnx_buffer_has_space(struct dnx_device *dnx, unsigned int nr_jobs)
+{
+	struct dnx_ringbuf *buffer = dnx->buffer;
+
+	if(dnx_buffer_fits(buffer, nr_jobs))
+		return true;
+
+	dnx_buffer_tail_from_stc(dnx, buffer);
+
+	return dnx_buffer_fits(buffer, nr_jobs);
+}
+
+
+/* Number of jobs a drained ring takes at once. The last END stays live and
+ * a wrap around may waste up to one job section. */
+unsigned int dnx_buffer_max_jobs(struct dnx_ringbuf *buffer)
+{
+	return buffer->size / (DNX_BUFFER_JOB_DWORDS * sizeof(u32)) - 2;
+}
+
+
+/* Called in queuing order for cmdbufs whose sync has been written: the STC
+ * is at their END (or the JMP replacing it) or beyond. Called again until
+ * they are retired, by then the tail may have been taken from the STC and
+ * their section reused, so positions are compared by lap. */
+void dnx_buffer_consumed(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf)
+{
+	dnx_buffer_move_tail(dnx->buffer, cmdbuf->ring_wraps,
+			cmdbuf->ring_pos + 2 * sizeof(u32));
+}
+
+
 static u32 dnx_buffer_reserve(struct dnx_device *dnx,
 		struct dnx_ringbuf *buffer, unsigned int cmd_dwords)
 {
 	if(buffer->user_size + cmd_dwords * sizeof(u32) > buffer->size) {
 		dev_dbg(dnx->dev, "buffer wrap around\n");
 		buffer->user_size = 0;
+		buffer->wraps++;
+		atomic_inc(&dnx->stats.ring_wraps);
 	}
 
 	return buffer->paddr + buffer->user_size;
@@ -75,30 +200,66 @@ static void patch_jmp(struct dnx_device *dnx, void *patch_addr, u32 data)
 }
 
 
-void dnx_buffer_queue(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf)
+static inline void CMD_JMP(struct dnx_ringbuf *buffer, u32 target)
 {
 	dnx_stream_cmd_word_t cmd;
-	struct dnx_ringbuf *buffer = dnx->buffer;
-	u32 *lw = buffer->vaddr + buffer->user_size - 8; /* position of last end */
-	u32 link_target;
-	u32 return_target;
-	unsigned long flags;
 
-	link_target = cmdbuf->paddr;
+	cmd.m_data = 0;
+	cmd.bits.m_cmd = DNX_STREAM_CMD_JMP;
+	cmd.bits.m_count = 1;
 
-	/* we leave space for the cmdbuf's syncid write (2 words) and the end
-	 * cmd (1 word) + 1 word for the next jump that will be added with the
-	 * next queuing */
-	return_target = dnx_buffer_reserve(dnx, buffer, 4);
+	OUT(buffer, cmd.m_data);
+	OUT(buffer, target);
+}
 
-	patch_jmp(dnx, cmdbuf->vjmpaddr, return_target);
 
-	CMD_SYNC(buffer, cmdbuf->fence);
-	CMD_END(buffer);
-	buffer->user_size += 4; /* reserve word for jump address */
+/* Links nr cmdbufs into the ring in this order. Each job gets its own ring
+ * section, but only the last one ends the ring, the others jump straight to
+ * the next job. That way the previous END is patched and the STC kicked only
+ * once per batch. The caller checked for space with dnx_buffer_has_space(). */
+void dnx_buffer_queue_batch(struct dnx_device *dnx,
+		struct dnx_cmdbuf **cmdbufs, unsigned int nr)
+{
+	dnx_stream_cmd_word_t cmd;
+	struct dnx_ringbuf *buffer = dnx->buffer;
+	u32 *lw = buffer->vaddr + buffer->user_size - 8; /* position of last end */
+	struct dnx_cmdbuf *first = cmdbufs[0];
+	struct dnx_cmdbuf *last = cmdbufs[nr - 1];
+	u32 return_target;
+	unsigned long flags;
+	unsigned int i;
+	bool started = false;
+
+	for(i = 0; i < nr; i++) {
+		struct dnx_cmdbuf *cmdbuf = cmdbufs[i];
+
+		/* we leave space for the cmdbuf's syncid write (2 words) and the
+		 * end cmd (1 word) + 1 word for the next jump that will be added
+		 * with the next queuing */
+		return_target = dnx_buffer_reserve(dnx, buffer,
+				DNX_BUFFER_JOB_DWORDS);
+		cmdbuf->ring_pos = return_target - buffer->paddr;
+		cmdbuf->ring_wraps = buffer->wraps;
+
+		patch_jmp(dnx, cmdbuf->vjmpaddr, return_target);
+		dnx_gem_sync_for_device(cmdbuf->jmp_bo,
+				cmdbuf->vjmpaddr - cmdbuf->jmp_bo->base.vaddr,
+				sizeof(u32));
+
+		CMD_SYNC(buffer, cmdbuf->fence);
+		if(cmdbuf == last) {
+			CMD_END(buffer);
+			buffer->user_size += 4; /* reserve word for jump address */
+		}
+		else {
+			CMD_JMP(buffer, cmdbufs[i + 1]->paddr);
+		}
+
+		trace_dnx_queue(cmdbuf);
+	}
 
 	/* now change the END into a JMP command, but write the address first */
-	lw[1] = cmdbuf->paddr;
+	lw[1] = first->paddr;
 	mb();
 
 	cmd.m_data = 0;
@@ -107,13 +268,19 @@ void dnx_buffer_queue(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf)
 	lw[0] = cmd.m_data;
 	mb();
 
-	/* If the STC has already halted, we can start in the job. If it
+	/* If the STC has already halted, we can start in the first job. If it
 	 * is still running, it will see the inserted jump. */
 	spin_lock_irqsave(&dnx->stc_lock, flags);
-	dnx->fence_active = cmdbuf->fence;
-	if(!dnx->stc_running & (dnx->fence_completed != cmdbuf->fence)) {
+	dnx->fence_active = last->fence;
+	if(!dnx->stc_running && dnx_stc_pending(dnx)) {
 		dnx->stc_running = true;
-		dnx_reg_write(dnx, DNX_REG_CONTROL_STREAM_ADDR, cmdbuf->paddr);
+		dnx_reg_write(dnx, DNX_REG_CONTROL_STREAM_ADDR, first->paddr);
+		started = true;
 	}
 	spin_unlock_irqrestore(&dnx->stc_lock, flags);
+
+	trace_dnx_stc_kick(dnx, last->fence, first->paddr, started);
+	if(started)
+		atomic_inc(&dnx->stats.stc_kicks);
 }
+
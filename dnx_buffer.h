@@ -5,8 +5,17 @@
 #include "dnx_gpu.h"
 
 
-void dnx_buffer_queue(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf);
+/* ring words per queued cmdbuf: sync write (2), end (1), jump address (1) */
+#define DNX_BUFFER_JOB_DWORDS (4)
+
+
+void dnx_buffer_queue_batch(struct dnx_device *dnx,
+		struct dnx_cmdbuf **cmdbufs, unsigned int nr);
 void dnx_buffer_init(struct dnx_device *dnx);
+bool dnx_buffer_has_space(struct dnx_device *dnx, unsigned int nr_jobs);
+unsigned int dnx_buffer_max_jobs(struct dnx_ringbuf *buffer);
+void dnx_buffer_consumed(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf);
+u32 dnx_buffer_space(struct dnx_ringbuf *buffer);
 
 
 #endif /* _DNX_BUFFER_H_ */
@@ -1,6 +1,7 @@
 #include "dnx_dbg.h"
 
 #include "dnx_drv.h"
+#include "dnx_gem.h"
 #include "dnx_gpu.h"
 #include "nx_register_address.h"
 
@@ -54,56 +55,41 @@ void dnx_debug_reg_dump(struct dnx_device *dnx)
 }
 
 
-static struct drm_gem_cma_object *find_bo_by_dma_addr(struct dnx_cmdbuf *cmdbuf, dma_addr_t addr)
-{
-	int i;
+/* Words around the one the STC stopped at, copied so they can be printed
+ * without holding the locks keeping the buffer alive. */
+#define DNX_DEBUG_CONTEXT_WORDS (5)
 
-	for(i = 0; i < cmdbuf->nr_bos; ++i) {
-		size_t size = cmdbuf->bos[i]->base.size;
-		dma_addr_t off = addr - cmdbuf->bos[i]->paddr;
+struct dnx_debug_context {
+	dma_addr_t paddr; /* of words[0] */
+	unsigned int nr;
+	unsigned int pos; /* index of the word at the stream position */
+	u32 words[2 * DNX_DEBUG_CONTEXT_WORDS + 1];
+};
 
-		if(off < size) {
-			return cmdbuf->bos[i];
-		}
-	}
 
-	return NULL;
-}
-
-
-/* note: caller must make sure that the device's lock is held when calling
- * this function. */
-static struct dnx_cmdbuf *find_cmdbuf_by_dma_addr(struct dnx_device *dnx, dma_addr_t addr, struct drm_gem_cma_object **bo)
+static void copy_buffer_context(struct dnx_debug_context *ctx, void *vaddr, dma_addr_t paddr, size_t size, u32 word_offset)
 {
-	struct dnx_cmdbuf *cmdbuf = NULL, *tmp;
-
-	if(bo)
-		*bo = NULL;
-
-	list_for_each_entry_safe(cmdbuf, tmp, &dnx->active_cmd_list, node) {
-		struct drm_gem_cma_object *obj = find_bo_by_dma_addr(cmdbuf, addr);
+	u32 *buffer = vaddr;
+	u32 start, end, i;
 
-		if(obj) {
-			if(bo)
-				*bo = obj;
-			return cmdbuf;
-		}
-	}
+	start = word_offset - min_t(u32, word_offset, DNX_DEBUG_CONTEXT_WORDS);
+	end = min_t(u32, word_offset + DNX_DEBUG_CONTEXT_WORDS + 1, size / sizeof(*buffer));
 
-	return NULL;
+	ctx->paddr = paddr + start * sizeof(*buffer);
+	ctx->pos = word_offset - start;
+	ctx->nr = 0;
+	for(i = start; i < end; ++i)
+		ctx->words[ctx->nr++] = READ_ONCE(buffer[i]);
 }
 
 
-static void print_buffer_context(struct dnx_device *dnx, void *vaddr, dma_addr_t paddr, size_t size, u32 word_offset)
+static void print_buffer_context(struct dnx_device *dnx, struct dnx_debug_context *ctx)
 {
-	int start, end, i;
-	u32 *buffer = vaddr;
+	unsigned int i;
 
-	start = (word_offset < 5) ? -word_offset : -5;
-	end = (word_offset > (size / sizeof(*buffer) - 6)) ? (word_offset - size / sizeof(*buffer)) : 6;
-	for(i = start; i < end; ++i) {
-		dev_info(dnx->dev, "%s0x%08x: %08x\n", i ? " " : ">", paddr + (word_offset + i) * sizeof(*buffer),
-				buffer[word_offset + i]);
+	for(i = 0; i < ctx->nr; ++i) {
+		dev_info(dnx->dev, "%s0x%08x: %08x\n", i == ctx->pos ? ">" : " ", ctx->paddr + i * sizeof(u32),
+				ctx->words[i]);
 	}
 }
 
@@ -111,6 +97,7 @@ static void print_buffer_context(struct dnx_device *dnx, void *vaddr, dma_addr_t
 void dnx_debug_stream_err(struct dnx_device *dnx)
 {
 	u32 stream_pos = dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS);
+	struct dnx_debug_context ctx;
 
 	dev_info(dnx->dev, "Context =================================================================\n");
 
@@ -119,27 +106,47 @@ void dnx_debug_stream_err(struct dnx_device *dnx)
 
 		dev_info(dnx->dev, "Error in ring buffer:\n");
 
-		print_buffer_context(dnx, dnx->buffer->vaddr, dnx->buffer->paddr, dnx->buffer->size, offset);
+		copy_buffer_context(&ctx, dnx->buffer->vaddr, dnx->buffer->paddr, dnx->buffer->size, offset);
+		print_buffer_context(dnx, &ctx);
 	}
 	else {
-		struct dnx_cmdbuf *cmdbuf;
+		struct dnx_cmdbuf_bo *entry;
+		struct dnx_cmdbuf *cmdbuf = NULL;
 		struct drm_gem_cma_object *bo = NULL;
+		dma_addr_t start = 0, phys = 0;
+		unsigned int nr_bos = 0;
+		u32 fence = 0;
+		size_t size = 0;
+		unsigned long flags;
 
 		dev_info(dnx->dev, "Error in user job:\n");
 
-		mutex_lock(&dnx->lock);
-		cmdbuf = find_cmdbuf_by_dma_addr(dnx, stream_pos, &bo);
+		/* only copied under the lock, printing may take long */
+		spin_lock_irqsave(&dnx->bo_tree_lock, flags);
+		entry = dnx_gpu_lookup_bo(dnx, stream_pos, NULL);
+		if(entry) {
+			cmdbuf = entry->cmdbuf;
+			bo = entry->obj;
+			start = cmdbuf->paddr;
+			nr_bos = cmdbuf->nr_bos;
+			fence = cmdbuf->fence;
+			phys = bo->paddr;
+			/* suballocated bos are smaller than their gem object */
+			size = to_dnx_bo(&bo->base)->size;
+			copy_buffer_context(&ctx, bo->vaddr, bo->paddr, size, (stream_pos - bo->paddr) / sizeof(u32));
+		}
+		spin_unlock_irqrestore(&dnx->bo_tree_lock, flags);
+
 		if(cmdbuf) {
 			dev_info(dnx->dev, " cmdbuf_obj=0x%p\n", cmdbuf);
-			dev_info(dnx->dev, "  start=0x%pad\n", &cmdbuf->paddr);
-			dev_info(dnx->dev, "  nr_bos=0x%u\n", cmdbuf->nr_bos);
-			dev_info(dnx->dev, "  fence=0x%u\n", cmdbuf->fence);
+			dev_info(dnx->dev, "  start=0x%pad\n", &start);
+			dev_info(dnx->dev, "  nr_bos=0x%u\n", nr_bos);
+			dev_info(dnx->dev, "  fence=0x%u\n", fence);
 			dev_info(dnx->dev, " gem_obj=0x%p\n", bo);
-			dev_info(dnx->dev, "  phys=0x%pad\n", &bo->paddr);
-			dev_info(dnx->dev, "  size=0x%zx\n", bo->base.size);
-			print_buffer_context(dnx, bo->vaddr, bo->paddr, bo->base.size, (stream_pos - cmdbuf->paddr) / sizeof(u32));
+			dev_info(dnx->dev, "  phys=0x%pad\n", &phys);
+			dev_info(dnx->dev, "  size=0x%zx\n", size);
+			print_buffer_context(dnx, &ctx);
 		}
-		mutex_unlock(&dnx->lock);
 	}
 
 	dev_info(dnx->dev, "=========================================================================\n");
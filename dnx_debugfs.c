@@ -2,6 +2,8 @@
 
 #include "dnx_drv.h"
 #include "dnx_gpu.h"
+#include "dnx_buffer.h"
+#include "dnx_emu.h"
 
 #include "nx_register_address.h"
 
@@ -17,22 +19,19 @@ static void print_reg(struct seq_file *m, const char *name, u32 val)
 
 static int show_gpu_regs(struct dnx_device *dnx, struct seq_file *m)
 {
-	u32 *reg = (u32*) dnx->mmio;
-	int i=0;
-
-	print_reg(m, STRING(DNX_REG_CONTROL_VERSION       ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_1      ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_2      ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_3      ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_BUSY          ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_IRQ_MASK      ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_IRQ_STATE     ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_STREAM_ADDR   ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_STREAM_POS    ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_0        ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_1        ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_2        ), reg[i++]);
-	print_reg(m, STRING(DNX_REG_CONTROL_RETURN_ADDRESS), reg[i++]);
+	print_reg(m, STRING(DNX_REG_CONTROL_VERSION       ), dnx_reg_read(dnx, DNX_REG_CONTROL_VERSION));
+	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_1      ), dnx_reg_read(dnx, DNX_REG_CONTROL_CONFIG_1));
+	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_2      ), dnx_reg_read(dnx, DNX_REG_CONTROL_CONFIG_2));
+	print_reg(m, STRING(DNX_REG_CONTROL_CONFIG_3      ), dnx_reg_read(dnx, DNX_REG_CONTROL_CONFIG_3));
+	print_reg(m, STRING(DNX_REG_CONTROL_BUSY          ), dnx_reg_read(dnx, DNX_REG_CONTROL_BUSY));
+	print_reg(m, STRING(DNX_REG_CONTROL_IRQ_MASK      ), dnx_reg_read(dnx, DNX_REG_CONTROL_IRQ_MASK));
+	print_reg(m, STRING(DNX_REG_CONTROL_IRQ_STATE     ), dnx_reg_read(dnx, DNX_REG_CONTROL_IRQ_STATE));
+	print_reg(m, STRING(DNX_REG_CONTROL_STREAM_ADDR   ), dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_ADDR));
+	print_reg(m, STRING(DNX_REG_CONTROL_STREAM_POS    ), dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS));
+	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_0        ), dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0));
+	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_1        ), dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_1));
+	print_reg(m, STRING(DNX_REG_CONTROL_SYNC_2        ), dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_2));
+	print_reg(m, STRING(DNX_REG_CONTROL_RETURN_ADDRESS), dnx_reg_read(dnx, DNX_REG_CONTROL_RETURN_ADDRESS));
 
 	return 0;
 }
@@ -43,10 +42,20 @@ static void print_buffer(struct dnx_device *dnx, struct seq_file *m)
 	struct dnx_ringbuf *buf = dnx->buffer;
 	u32 size = buf->size;
 	u32 *ptr = buf->vaddr;
+	u32 head, tail, space;
 	u32 i;
 
-	seq_printf(m, "virt %p - phys 0x%llx - free 0x%08x\n",
-			buf->vaddr, (u64)buf->paddr, size - buf->user_size);
+	/* only the pointers are consistent, the words are dumped unlocked */
+	mutex_lock(&dnx->lock);
+	spin_lock_irq(&dnx->active_lock);
+	head = buf->user_size;
+	tail = buf->tail;
+	space = dnx_buffer_space(buf);
+	spin_unlock_irq(&dnx->active_lock);
+	mutex_unlock(&dnx->lock);
+
+	seq_printf(m, "virt %p - phys 0x%llx - head 0x%08x - tail 0x%08x - free 0x%08x\n",
+			buf->vaddr, (u64)buf->paddr, head, tail, space);
 
 	for (i = 0; i < size / 4; i++) {
 		if (i && !(i % 4))
@@ -63,9 +72,7 @@ static int show_ring(struct dnx_device *dnx, struct seq_file *m)
 {
 	seq_printf(m, "Ring buffer (%s): ", dev_name(dnx->dev));
 
-	mutex_lock(&dnx->lock);
 	print_buffer(dnx, m);
-	mutex_unlock(&dnx->lock);
 
 	return 0;
 }
@@ -79,10 +86,9 @@ static int show_mm(struct dnx_device *dnx, struct seq_file *m)
 
 static int show_busy(struct dnx_device *dnx, struct seq_file *m)
 {
-	u32 *reg = (u32*) dnx->mmio;
 	u32 busy;
 
-	busy = reg[DNX_REG_CONTROL_BUSY];
+	busy = dnx_reg_read(dnx, DNX_REG_CONTROL_BUSY);
 
 	if(!busy) {
 		seq_printf(m, "core ready...\n");
@@ -141,17 +147,115 @@ static int show_unlocked(struct seq_file *m, void *arg)
 
 static int show_status(struct dnx_device *dnx, struct seq_file *m)
 {
-	u32 *reg = (u32*) dnx->mmio;
+	u32 pos = dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS);
 
 	seq_printf(m, "STC: ");
 	if(dnx->stc_running) {
-		seq_printf(m, "running (0x%08x)\n", reg[DNX_REG_CONTROL_STREAM_POS]);
+		seq_printf(m, "running (0x%08x)\n", pos);
 	}
 	else {
-		seq_printf(m, "stopped (0x%08x)\n", reg[DNX_REG_CONTROL_STREAM_POS]);
+		seq_printf(m, "stopped (0x%08x)\n", pos);
+	}
+
+	seq_printf(m, "last fence: %d\n", dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0));
+
+	if(dnx->emu)
+		seq_printf(m, "emulated: %lu commands, %lu faults\n",
+				READ_ONCE(dnx->emu->cmds),
+				READ_ONCE(dnx->emu->faults));
+
+	return 0;
+}
+
+
+static int show_latency(struct dnx_device *dnx, struct seq_file *m)
+{
+	struct dnx_hist queue_wait, exec, total;
+
+	spin_lock(&dnx->stats.lock);
+	queue_wait = dnx->stats.queue_wait;
+	exec = dnx->stats.exec;
+	total = dnx->stats.total;
+	spin_unlock(&dnx->stats.lock);
+
+	dnx_hist_show(m, "queue wait", "us", &queue_wait);
+	dnx_hist_show(m, "execution", "us", &exec);
+	dnx_hist_show(m, "submit to retire", "us", &total);
+
+	return 0;
+}
+
+
+static int show_queue(struct dnx_device *dnx, struct seq_file *m)
+{
+	struct dnx_hist depth;
+	unsigned int i;
+
+	spin_lock(&dnx->stats.lock);
+	depth = dnx->stats.depth;
+	spin_unlock(&dnx->stats.lock);
+
+	seq_printf(m, "in flight: %u (window %u)\n",
+			READ_ONCE(dnx->active_cmd_count), dnx->sched_window);
+	for(i = 0; i < DNX_SCHED_PRIOS; i++)
+		seq_printf(m, "queued prio %u: %u\n", i,
+				READ_ONCE(dnx->sched_count[i]));
+	seq_printf(m, "ring wraps: %d\n", atomic_read(&dnx->stats.ring_wraps));
+	seq_printf(m, "STC kicks: %d\n", atomic_read(&dnx->stats.stc_kicks));
+	seq_printf(m, "STC restarts: %d\n",
+			atomic_read(&dnx->stats.stc_restarts));
+	seq_printf(m, "fair share overtakes: %d\n",
+			atomic_read(&dnx->stats.fair_overtakes));
+	seq_printf(m, "hangs: %d\n", atomic_read(&dnx->stats.hangs));
+	dnx_hist_show(m, "depth", "cmdbufs", &depth);
+
+	return 0;
+}
+
+
+static int show_bo_cache(struct dnx_device *dnx, struct seq_file *m)
+{
+	dnx_gem_cache_show(&dnx->bo_cache, m);
+
+	return 0;
+}
+
+
+/* Fair share state, vruntime relative to the one of the last picked client.
+ * Clients with the least vruntime get the ring next. */
+static int show_clients(struct dnx_device *dnx, struct seq_file *m)
+{
+	struct dnx_file_priv *priv;
+
+	seq_printf(m, "%8s %12s %8s %10s %12s %6s\n",
+			"client", "vruntime us", "queued", "jobs", "busy us",
+			"slabs");
+
+	mutex_lock(&dnx->lock);
+	list_for_each_entry(priv, &dnx->client_list, client_node) {
+		s64 vruntime = atomic64_read(&priv->vruntime) -
+			dnx->sched_min_vruntime;
+
+		seq_printf(m, "%8llu %12lld %8u %10lld %12lld %6u\n", priv->id,
+				div_s64(vruntime, NSEC_PER_USEC),
+				priv->sched_queued,
+				(long long)atomic64_read(&priv->jobs),
+				div_s64(atomic64_read(&priv->busy_ns),
+					NSEC_PER_USEC),
+				READ_ONCE(priv->nr_slabs));
 	}
+	mutex_unlock(&dnx->lock);
+
+	return 0;
+}
+
+
+/* todo: replace by writable sysfs file and reset when 1 is written to it */
+static int show_stats_reset(struct dnx_device *dnx, struct seq_file *m)
+{
+	seq_printf(m, "resetting statistics...\n");
 
-	seq_printf(m, "last fence: %d\n", reg[DNX_REG_CONTROL_SYNC_0]);
+	dnx_stats_reset(&dnx->stats);
 
 	return 0;
 }
@@ -175,6 +279,11 @@ static struct drm_info_list dnx_debugfs_list[] = {
 		{"busy", show_unlocked, 0, show_busy},
 		{"reset", show_unlocked, 0, show_reset},
 		{"status", show_unlocked, 0, show_status},
+		{"latency", show_unlocked, 0, show_latency},
+		{"queue", show_unlocked, 0, show_queue},
+		{"clients", show_unlocked, 0, show_clients},
+		{"bo_cache", show_unlocked, 0, show_bo_cache},
+		{"stats_reset", show_unlocked, 0, show_stats_reset},
 };
 
 
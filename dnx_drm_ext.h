@@ -0,0 +1,202 @@
+#ifndef __DNX_DRM_EXT_H__
+#define __DNX_DRM_EXT_H__
+
+/*
+ * Interface extensions on top of <drm/dnx_drm.h>. Ioctl numbers continue
+ * after DRM_DNX_NUM_IOCTLS, structures only ever grow at their end.
+ */
+
+#include <drm/dnx_drm.h>
+
+
+/* GEM_NEW flag next to DNX_BO_x: a bo of up to half a page may share pages
+ * with other small bos of the client. Its paddr is then not page aligned,
+ * mmap maps the pages it touches and the bo starts at the in-page offset of
+ * paddr. Such bos can't be exported. */
+#define DNX_BO_SUBALLOC          0x00100000
+
+/* At most one of DNX_BO_CACHED, DNX_BO_WC and DNX_BO_UNCACHED may be given,
+ * DNX_BO_WC is the default. The GPU does not snoop the CPU caches: CPU
+ * writes to a DNX_BO_CACHED bo have to follow a CPU_PREP with DNX_PREP_WRITE,
+ * they are cleaned to memory by the next GEM_CPU_FINI or submit using the
+ * bo. CPU_PREP invalidates the bo after waiting, so reads after it see what
+ * the GPU wrote. DNX_BO_SUBALLOC is ignored for
+ * cached and uncached bos, they can't be exported. */
+
+
+/* submit flags */
+#define DNX_SUBMIT_FENCE_FD_IN   0x0001 /* wait for fence_fd before execution */
+#define DNX_SUBMIT_FENCE_FD_OUT  0x0002 /* return a sync_file fd in fence_fd */
+#define DNX_SUBMIT_BO_FLAGS      0x0004 /* bos is an array of drm_dnx_submit_bo */
+#define DNX_SUBMIT_WAIT          0x0008 /* wait for completion until timeout */
+#define DNX_SUBMIT_EVENT         0x0010 /* send DRM_DNX_EVENT_FENCE on completion */
+#define DNX_SUBMIT_FLAGS         (DNX_SUBMIT_FENCE_FD_IN | \
+                                  DNX_SUBMIT_FENCE_FD_OUT | \
+                                  DNX_SUBMIT_BO_FLAGS | \
+                                  DNX_SUBMIT_WAIT | \
+                                  DNX_SUBMIT_EVENT)
+
+/*
+ * With DNX_SUBMIT_WAIT the ioctl waits for the (last) submitted job like
+ * DRM_IOCTL_DNX_WAIT_FENCE would. The jobs are queued when the ioctl
+ * succeeds, whatever the outcome of the wait in wait_result is, so an
+ * interrupted wait never resubmits them.
+ */
+
+/* per bo access flags, bos without flags are treated as read/write */
+#define DNX_SUBMIT_BO_READ       0x0001
+#define DNX_SUBMIT_BO_WRITE      0x0002
+
+struct drm_dnx_submit_bo {
+	__u32 handle;
+	__u32 flags;       /* mask of DNX_SUBMIT_BO_x */
+};
+
+/*
+ * With DNX_SUBMIT_EVENT a drm_dnx_event_fence can be read from the file once
+ * the (last) submitted job completed, poll() reports it as readable. The
+ * event is reserved at submit, which fails with -ENOMEM once the file's
+ * unread events exceed the event space of the DRM core.
+ */
+#define DRM_DNX_EVENT_FENCE      0x80000000
+
+struct drm_dnx_event_fence {
+	struct drm_event base;   /* type DRM_DNX_EVENT_FENCE */
+	__u64 user_data;         /* event_data of the submit */
+	struct drm_dnx_timespec timestamp; /* CLOCK_MONOTONIC of the signaling */
+	__u32 fence;             /* fence of the submit */
+	__s32 error;             /* 0 or the error of a job failed by the hang
+	                          * recovery */
+};
+
+struct drm_dnx_stream_submit_ext {
+	__u64 stream;      /* in, start address of stream */
+	__u64 jump;        /* in, address of the stream's final jump */
+	__u64 bos;         /* in, ptr to array of __u32 bo handles or
+	                    * drm_dnx_submit_bo with DNX_SUBMIT_BO_FLAGS */
+	__u32 nr_bos;      /* in, number of bo handles */
+	__u32 flags;       /* in, mask of DNX_SUBMIT_x */
+	__s32 fence_fd;    /* in/out, see DNX_SUBMIT_FENCE_FD_x */
+	__u32 fence;       /* out */
+	struct drm_dnx_timespec timeout; /* in, absolute, see DNX_SUBMIT_WAIT */
+	__s32 wait_result; /* out, 0 or -errno of the wait, see DNX_SUBMIT_WAIT */
+	__u32 queue;       /* in, submit queue id, 0 for the default queue */
+	__u64 event_data;  /* in, user_data of the event, see DNX_SUBMIT_EVENT */
+};
+
+/* streams of a batch are executed in array order */
+#define DNX_SUBMIT_MAX_STREAMS   64
+
+struct drm_dnx_submit_stream {
+	__u64 stream;      /* in, start address of stream */
+	__u64 jump;        /* in, address of the stream's final jump */
+	__u64 bos;         /* in, as in drm_dnx_stream_submit_ext */
+	__u32 nr_bos;      /* in, number of bo handles */
+	__u32 fence;       /* out */
+};
+
+struct drm_dnx_stream_submit_batch {
+	__u64 streams;     /* in, ptr to array of drm_dnx_submit_stream */
+	__u32 nr_streams;  /* in, at most DNX_SUBMIT_MAX_STREAMS */
+	__u32 flags;       /* in, mask of DNX_SUBMIT_x for the whole batch */
+	__s32 fence_fd;    /* in/out, see DNX_SUBMIT_FENCE_FD_x, the out fence
+	                    * signals when the whole batch completed */
+	__u32 fence;       /* out, fence of the last stream */
+	struct drm_dnx_timespec timeout; /* in, absolute, see DNX_SUBMIT_WAIT */
+	__s32 wait_result; /* out, 0 or -errno of the wait, see DNX_SUBMIT_WAIT */
+	__u32 queue;       /* in, submit queue id, 0 for the default queue */
+	__u64 event_data;  /* in, user_data of the event, see DNX_SUBMIT_EVENT */
+};
+
+/*
+ * Submit queues. Jobs of a queue execute in submit order, but queued jobs of
+ * a higher priority queue overtake those of lower ones. Queue id 0 is the
+ * default queue of normal priority, the fences returned by the submit
+ * ioctls are unique across all queues.
+ */
+#define DNX_SUBMITQUEUE_PRIO_LOW     0
+#define DNX_SUBMITQUEUE_PRIO_NORMAL  1
+#define DNX_SUBMITQUEUE_PRIO_HIGH    2
+
+struct drm_dnx_submitqueue {
+	__u32 flags;       /* in, must be 0 */
+	__u32 prio;        /* in, DNX_SUBMITQUEUE_PRIO_x */
+	__u32 id;          /* out */
+	__u32 pad;
+};
+
+/*
+ * Persistent jobs for streams submitted over and over. JOB_NEW resolves the
+ * bos and the final jump of a stream once and keeps the bos referenced
+ * until JOB_CLOSE. JOB_SUBMIT then queues the job like STREAM_SUBMIT_EXT
+ * would. The stream's final jump is patched for every run, so a run stays
+ * queued until the previous run of the same job completed, the ioctl does
+ * not wait for it.
+ */
+struct drm_dnx_job {
+	__u64 stream;      /* in, start address of stream */
+	__u64 jump;        /* in, address of the stream's final jump */
+	__u64 bos;         /* in, as in drm_dnx_stream_submit_ext */
+	__u32 nr_bos;      /* in, number of bo handles */
+	__u32 flags;       /* in, 0 or DNX_SUBMIT_BO_FLAGS */
+	__u32 id;          /* out */
+	__u32 pad;
+};
+
+struct drm_dnx_job_submit {
+	__u32 id;          /* in, job id of JOB_NEW */
+	__u32 flags;       /* in, mask of DNX_SUBMIT_x but DNX_SUBMIT_BO_FLAGS */
+	__s32 fence_fd;    /* in/out, see DNX_SUBMIT_FENCE_FD_x */
+	__u32 fence;       /* out */
+	struct drm_dnx_timespec timeout; /* in, absolute, see DNX_SUBMIT_WAIT */
+	__s32 wait_result; /* out, 0 or -errno of the wait, see DNX_SUBMIT_WAIT */
+	__u32 queue;       /* in, submit queue id, 0 for the default queue */
+	__u64 event_data;  /* in, user_data of the event, see DNX_SUBMIT_EVENT */
+};
+
+/*
+ * Waits for several fences of STREAM_SUBMIT_x or JOB_SUBMIT with one timeout.
+ * With DNX_WAIT_ANY the wait ends once one of them signaled, otherwise once
+ * all did, DNX_WAIT_NONBLOCK only checks. first is set to the lowest index
+ * of a signaled fence, nr_fences if there is none, and the status of every
+ * fence goes to the status array if given: 0 once signaled, -EBUSY while
+ * pending or the error of a job failed by the hang recovery. The ioctl
+ * returns -EBUSY or -ETIMEDOUT if the wait did not end, otherwise the
+ * error of fence first with DNX_WAIT_ANY, that of any fence without.
+ */
+#define DNX_WAIT_ANY             0x0002 /* next to DNX_WAIT_NONBLOCK */
+#define DNX_WAIT_FLAGS           (DNX_WAIT_NONBLOCK | DNX_WAIT_ANY)
+#define DNX_WAIT_MAX_FENCES      64
+
+struct drm_dnx_wait_fences {
+	__u64 fences;      /* in, ptr to array of __u32 fence ids */
+	__u64 status;      /* in, ptr to array of __s32 for the fences' status
+	                    * or 0 */
+	__u32 nr_fences;   /* in, at most DNX_WAIT_MAX_FENCES */
+	__u32 flags;       /* in, mask of DNX_WAIT_x */
+	struct drm_dnx_timespec timeout; /* in, absolute */
+	__u32 first;       /* out, index of the first signaled fence */
+	__u32 pad;
+};
+
+
+#define DRM_DNX_STREAM_SUBMIT_EXT    (DRM_DNX_NUM_IOCTLS + 0x00)
+#define DRM_DNX_STREAM_SUBMIT_BATCH  (DRM_DNX_NUM_IOCTLS + 0x01)
+#define DRM_DNX_SUBMITQUEUE_NEW      (DRM_DNX_NUM_IOCTLS + 0x02)
+#define DRM_DNX_SUBMITQUEUE_CLOSE    (DRM_DNX_NUM_IOCTLS + 0x03)
+#define DRM_DNX_JOB_NEW              (DRM_DNX_NUM_IOCTLS + 0x04)
+#define DRM_DNX_JOB_CLOSE            (DRM_DNX_NUM_IOCTLS + 0x05)
+#define DRM_DNX_JOB_SUBMIT           (DRM_DNX_NUM_IOCTLS + 0x06)
+#define DRM_DNX_WAIT_FENCES          (DRM_DNX_NUM_IOCTLS + 0x07)
+#define DRM_DNX_EXT_NUM_IOCTLS       (DRM_DNX_NUM_IOCTLS + 0x08)
+
+#define DRM_IOCTL_DNX_STREAM_SUBMIT_EXT   DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_STREAM_SUBMIT_EXT, struct drm_dnx_stream_submit_ext)
+#define DRM_IOCTL_DNX_STREAM_SUBMIT_BATCH DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_STREAM_SUBMIT_BATCH, struct drm_dnx_stream_submit_batch)
+#define DRM_IOCTL_DNX_SUBMITQUEUE_NEW     DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_SUBMITQUEUE_NEW, struct drm_dnx_submitqueue)
+#define DRM_IOCTL_DNX_SUBMITQUEUE_CLOSE   DRM_IOW(DRM_COMMAND_BASE + DRM_DNX_SUBMITQUEUE_CLOSE, __u32)
+#define DRM_IOCTL_DNX_JOB_NEW             DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_JOB_NEW, struct drm_dnx_job)
+#define DRM_IOCTL_DNX_JOB_CLOSE           DRM_IOW(DRM_COMMAND_BASE + DRM_DNX_JOB_CLOSE, __u32)
+#define DRM_IOCTL_DNX_JOB_SUBMIT          DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_JOB_SUBMIT, struct drm_dnx_job_submit)
+#define DRM_IOCTL_DNX_WAIT_FENCES         DRM_IOWR(DRM_COMMAND_BASE + DRM_DNX_WAIT_FENCES, struct drm_dnx_wait_fences)
+
+#endif /* __DNX_DRM_EXT_H__ */
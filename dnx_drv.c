@@ -12,12 +12,51 @@
 #include "dnx_gem.h"
 #include "dnx_dbg.h"
 #include "dnx_debugfs.h"
+#include "dnx_emu.h"
+#include "dnx_trace.h"
 #include "nx_register_address.h"
 
 static int recover = 0;
 
 module_param(recover, int, 0444);
-MODULE_PARM_DESC(recover, "enable recovering from hang up");
+MODULE_PARM_DESC(recover, "enable resetting the core and replaying innocent jobs on hang up");
+
+static int ring_pages = DNX_RINGBUFFER_PAGES;
+
+module_param(ring_pages, int, 0444);
+MODULE_PARM_DESC(ring_pages, "size of the ring buffer in pages");
+
+unsigned int dnx_wait_spin_us = DNX_WAIT_SPIN_US;
+
+module_param_named(wait_spin_us, dnx_wait_spin_us, uint, 0644);
+MODULE_PARM_DESC(wait_spin_us, "max. time to poll for a fence before sleeping (0 = never)");
+
+unsigned int dnx_hang_timeout_ms = DNX_HANG_TIMEOUT_MS;
+
+module_param_named(hang_timeout_ms, dnx_hang_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(hang_timeout_ms, "time without progress after which the core is considered hung (0 = never)");
+
+unsigned int dnx_bo_cache_kb = DNX_GEM_CACHE_KB;
+
+module_param_named(bo_cache_kb, dnx_bo_cache_kb, uint, 0644);
+MODULE_PARM_DESC(bo_cache_kb, "max. memory of freed bos kept for reuse (0 = no cache)");
+
+static int hw_window = DNX_SCHED_WINDOW;
+
+module_param(hw_window, int, 0444);
+MODULE_PARM_DESC(hw_window, "max. jobs linked into the ring, queued jobs wait in the scheduler");
+
+static bool emulate;
+
+module_param(emulate, bool, 0444);
+MODULE_PARM_DESC(emulate, "register an emulated core instead of driving the hardware");
+
+unsigned int dnx_emu_cmd_ns = DNX_EMU_CMD_NS;
+
+module_param_named(emulate_cmd_ns, dnx_emu_cmd_ns, uint, 0644);
+MODULE_PARM_DESC(emulate_cmd_ns, "execution time of a stream command of the emulated core");
+
+static struct platform_device *dnx_emu_pdev;
 
 static const struct platform_device_id dnx_id_table[] = {
   { "dnx", 0 },
@@ -33,14 +72,38 @@ MODULE_DEVICE_TABLE(of, dnx_of_table);
 
 u32 dnx_reg_read(struct dnx_device *dnx, u32 reg)
 {
+  if(unlikely(dnx->emu))
+    return dnx_emu_reg_read(dnx->emu, reg);
+
   return ioread32(dnx->mmio + (reg*4));
 }
 
 void dnx_reg_write(struct dnx_device *dnx, u32 reg, u32 val)
 {
+  if(unlikely(dnx->emu)) {
+    dnx_emu_reg_write(dnx->emu, reg, val);
+    return;
+  }
+
   iowrite32(val, dnx->mmio + (reg*4));
 }
 
+void dnx_irq_disable(struct dnx_device *dnx)
+{
+	if(dnx->emu)
+		dnx_emu_irq_disable(dnx->emu);
+	else
+		disable_irq(dnx->irq);
+}
+
+void dnx_irq_enable(struct dnx_device *dnx)
+{
+	if(dnx->emu)
+		dnx_emu_irq_enable(dnx->emu);
+	else
+		enable_irq(dnx->irq);
+}
+
 /*
  * DNX ioctls:
  */
@@ -94,10 +157,12 @@ static int dnx_ioctl_gem_new(struct drm_device *dev, void *data,
 	dev_dbg(dev->dev, " size=0x%08llx\n", args->size);
 	dev_dbg(dev->dev, " flags=0x%08x\n", args->flags);
 
-	if (args->flags & ~(DNX_BO_CACHED | DNX_BO_WC | DNX_BO_UNCACHED))
+	if (args->flags & ~(DNX_BO_CACHED | DNX_BO_WC | DNX_BO_UNCACHED |
+			DNX_BO_SUBALLOC))
 			return -EINVAL;
 
-	bo = dnx_gem_new(dev, args->size, &paddr);
+	bo = dnx_gem_new(dev, args->size, args->flags, file->driver_priv,
+			&paddr);
 	if(IS_ERR(bo))
 		return PTR_ERR(bo);
 
@@ -155,17 +220,12 @@ static int dnx_ioctl_gem_user(struct drm_device *dev, void *data,
 	return 0;
 }
 
-#define TS(t) ((struct timespec){ \
-	.tv_sec = (t).tv_sec, \
-	.tv_nsec = (t).tv_nsec \
-})
-
 static int dnx_ioctl_gem_cpu_prep(struct drm_device *dev, void *data,
 		struct drm_file *file)
 {
 	struct drm_dnx_gem_cpu_prep *args = data;
 	struct drm_gem_object *obj;
-	int ret = -1;
+	int ret;
 
 	if (args->op & ~(DNX_PREP_READ | DNX_PREP_WRITE | DNX_PREP_NOSYNC))
 		return -EINVAL;
@@ -174,8 +234,7 @@ static int dnx_ioctl_gem_cpu_prep(struct drm_device *dev, void *data,
 	if (!obj)
 		return -ENOENT;
 
-//	ret = dnx_gem_cpu_prep(obj, args->op, &TS(args->timeout));
-	dev_err(dev->dev, "dnx_ioctl_gem_cpu_prep not implemented yet\n");
+	ret = dnx_gem_cpu_prep(obj, args->op, &TS(args->timeout));
 
 	drm_gem_object_unreference_unlocked(obj);
 
@@ -187,7 +246,7 @@ static int dnx_ioctl_gem_cpu_fini(struct drm_device *dev, void *data,
 {
 	struct drm_dnx_gem_cpu_fini *args = data;
 	struct drm_gem_object *obj;
-	int ret = -1;
+	int ret;
 
 	if (args->flags)
 		return -EINVAL;
@@ -196,8 +255,7 @@ static int dnx_ioctl_gem_cpu_fini(struct drm_device *dev, void *data,
 	if (!obj)
 		return -ENOENT;
 
-//	ret = dnx_gem_cpu_fini(obj);
-	dev_err(dev->dev, "dnx_ioctl_gem_cpu_fini not implemented yet\n");
+	ret = dnx_gem_cpu_fini(obj);
 
 	drm_gem_object_unreference_unlocked(obj);
 
@@ -225,6 +283,53 @@ static int dnx_ioctl_wait_fence(struct drm_device *dev, void *data,
 	return ret;
 }
 
+/* Waits for the first or all of several fences, the status of each one is
+ * returned even if the wait did not end. */
+static int dnx_ioctl_wait_fences(struct drm_device *dev, void *data,
+	struct drm_file *file)
+{
+	struct drm_dnx_wait_fences *args = data;
+	struct timespec *timeout = &TS(args->timeout);
+	unsigned int nr = args->nr_fences;
+	u32 *ids;
+	s32 *status;
+	int ret;
+
+	if(args->flags & ~DNX_WAIT_FLAGS)
+		return -EINVAL;
+	if(nr == 0 || nr > DNX_WAIT_MAX_FENCES)
+		return -EINVAL;
+
+	if(args->flags & DNX_WAIT_NONBLOCK)
+		timeout = NULL;
+
+	/* ids and statuses share one allocation */
+	ids = kmalloc(nr * (sizeof(*ids) + sizeof(*status)), GFP_KERNEL);
+	if(!ids)
+		return -ENOMEM;
+	status = (s32 *)(ids + nr);
+
+	if(copy_from_user(ids, u64_to_user_ptr(args->fences),
+			nr * sizeof(*ids))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = dnx_gpu_wait_fences_interruptible(dev->dev_private, ids, nr,
+			args->flags & DNX_WAIT_ANY, timeout, status, &args->first);
+	if(ret == -EINVAL || ret == -ENOMEM)
+		goto out;
+
+	if(args->status && copy_to_user(u64_to_user_ptr(args->status), status,
+			nr * sizeof(*status)))
+		ret = -EFAULT;
+
+out:
+	kfree(ids);
+
+	return ret;
+}
+
 static const struct drm_ioctl_desc dnx_ioctls[] = {
 #define DNX_IOCTL(n, func, flags) \
 	DRM_IOCTL_DEF_DRV(DNX_##n, dnx_ioctl_##func, flags)
@@ -239,29 +344,34 @@ static const struct drm_ioctl_desc dnx_ioctls[] = {
 	DNX_IOCTL(GEM_USER,      gem_user,      DRM_AUTH|DRM_RENDER_ALLOW),
 	DNX_IOCTL(GEM_CPU_PREP,  gem_cpu_prep,  DRM_AUTH|DRM_RENDER_ALLOW),
 	DNX_IOCTL(GEM_CPU_FINI,  gem_cpu_fini,  DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(STREAM_SUBMIT_EXT, gem_submit_ext, DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(STREAM_SUBMIT_BATCH, gem_submit_batch, DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(SUBMITQUEUE_NEW, submitqueue_new, DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(SUBMITQUEUE_CLOSE, submitqueue_close, DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(JOB_NEW,       job_new,       DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(JOB_CLOSE,     job_close,     DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(JOB_SUBMIT,    job_submit,    DRM_AUTH|DRM_RENDER_ALLOW),
+	DNX_IOCTL(WAIT_FENCES,   wait_fences,   DRM_AUTH|DRM_RENDER_ALLOW),
 };
 
+/* Hard irq part: acknowledges and latches the irq, updates the completed
+ * fence and restarts the STC. Everything else is left to irq_thread. */
 static irqreturn_t irq_handler(int irq, void *data)
 {
 	struct dnx_device *dnx = data;
 	u32 stat = dnx_reg_read(dnx, DNX_REG_CONTROL_IRQ_STATE);
+	bool stalled = false;
 
 	dnx_reg_write(dnx, DNX_REG_CONTROL_IRQ_STATE, stat);
 
 	stat &= dnx->reg_irqmask;
-
-	if(stat & DNX_IRQ_MASK_STREAM_SOFT) {
-		dev_info(dnx->dev, "IRQ soft triggered\n");
-	}
-
-	if(stat & DNX_IRQ_MASK_SDMA_DONE) {
-		dev_info(dnx->dev, "IRQ SDMA transfer finished\n");
-	}
+	if(!stat)
+		return IRQ_HANDLED;
 
 	if(stat & DNX_IRQ_MASK_STREAM_SYNC) {
 		dnx->fence_completed = dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0);
-		wake_up_interruptible(&dnx->fence_waitq);
-		dnx_queue_work(dnx->drm, &dnx->retire_work);
+		dnx->sync_time = ktime_get();
+		trace_dnx_sync_irq(dnx);
 	}
 
 
@@ -272,29 +382,83 @@ static irqreturn_t irq_handler(int irq, void *data)
 		dev_dbg(dnx->dev, "IRQ_STREAM: fence_completed=%d fence_active=%d\n",
 				dnx->fence_completed, dnx->fence_active);
 		/* Retrigger stream controller if we have outstanding command lists */
-		if(dnx->fence_completed < dnx->fence_active) {
+		if(dnx_stc_pending(dnx)) {
 			/* We end up here, if the stream controller reached the last END cmd just
 			 * before the next cmdbuf was queued.
 			 */
 			u32 stc_pos;
+			int polls = DNX_STC_START_POLLS;
 			/* we can use STC's stop position since it has been changed to a JMP already */
 			dev_dbg(dnx->dev, "Restarting STC (completed=%u, active=%u\n",
 					dnx->fence_completed, dnx->fence_active);
 			stc_pos = dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS);
 			dnx_reg_write(dnx, DNX_REG_CONTROL_STREAM_ADDR, stc_pos);
+			trace_dnx_stc_done(dnx, stc_pos, true);
+			atomic_inc(&dnx->stats.stc_restarts);
+			/* bounded, a late start is only reported by the thread */
 			while(!(dnx_reg_read(dnx, DNX_REG_CONTROL_BUSY) & 0x1)) {
-				dev_dbg(dnx->dev, "Wait for STC to start...\n");
-				// NOP
+				if(!--polls) {
+					stalled = true;
+					break;
+				}
+				cpu_relax();
 			}
 		}
 		else {
 			dev_dbg(dnx->dev, "Stopping STC (c=%u,a=%u)\n",
 					dnx->fence_completed, dnx->fence_active);
 			dnx->stc_running = false;
+			trace_dnx_stc_done(dnx, 0, false);
 		}
 		spin_unlock(&dnx->stc_lock);
 	}
 
+	spin_lock(&dnx->irq_lock);
+	dnx->irq_status |= stat;
+	dnx->irq_stc_stalled |= stalled;
+	spin_unlock(&dnx->irq_lock);
+
+	return IRQ_WAKE_THREAD;
+}
+
+/* Threaded irq part: signals fences, wakes up waiters, queues retiring and
+ * reports. Runs for one or more latched hard irqs. */
+static irqreturn_t irq_thread(int irq, void *data)
+{
+	struct dnx_device *dnx = data;
+	bool stalled;
+	u32 stat;
+
+	spin_lock_irq(&dnx->irq_lock);
+	stat = dnx->irq_status;
+	stalled = dnx->irq_stc_stalled;
+	dnx->irq_status = 0;
+	dnx->irq_stc_stalled = false;
+	spin_unlock_irq(&dnx->irq_lock);
+
+	/* an earlier run consumed the latched status already, the irq was
+	 * ours and handled in hard context, so don't count it as spurious */
+	if(!stat)
+		return IRQ_HANDLED;
+
+	if(stat & DNX_IRQ_MASK_STREAM_SOFT) {
+		dev_info(dnx->dev, "IRQ soft triggered\n");
+	}
+
+	if(stat & DNX_IRQ_MASK_SDMA_DONE) {
+		dev_info(dnx->dev, "IRQ SDMA transfer finished\n");
+	}
+
+	if(stat & DNX_IRQ_MASK_STREAM_SYNC) {
+		dnx_gpu_signal_fences(dnx);
+		wake_up_interruptible(&dnx->fence_waitq);
+		dnx_gpu_sched_kick(dnx);
+		dnx_queue_work(dnx->drm, &dnx->retire_work);
+	}
+
+	if(stalled)
+		dev_warn(dnx->dev, "STC not busy after restart\n");
+
 	if(stat & DNX_IRQ_MASK_ERRORS) {
 		dnx_debug_irq(dnx, stat);
 		dnx_debug_reg_dump(dnx);
@@ -304,9 +468,9 @@ static irqreturn_t irq_handler(int irq, void *data)
 	} 
 
 	/* Debug stuff */
-	spin_lock(&dnx->debug_irq_slck);
+	spin_lock_irq(&dnx->debug_irq_slck);
 	dnx->debug_irq = stat;
-	spin_unlock(&dnx->debug_irq_slck);
+	spin_unlock_irq(&dnx->debug_irq_slck);
 	wake_up_interruptible(&dnx->debug_irq_waitq);
 
 	return IRQ_HANDLED;
@@ -330,7 +494,7 @@ int dnx_mmap(struct file *filp, struct vm_area_struct *vma)
 
 		dev_dbg(dev->dev, "mmap cma bo vm_pgoff=%lx\n", vma->vm_pgoff);
 
-		ret = drm_gem_cma_mmap(filp, vma);
+		ret = dnx_gem_mmap(filp, vma);
 		if (ret) {
 			dev_err(dev->dev, "mmap gem cma failed: %d", ret);
 			return ret;
@@ -340,7 +504,10 @@ int dnx_mmap(struct file *filp, struct vm_area_struct *vma)
 		/* We detect the mapping type by its size.
 		 * Register mapping should be removed and replaced by specific IOCTLs.
 		 */
-		if(size == dnx->mmio_size) {
+		if(dnx->emu) {
+			return -ENODEV;
+		}
+		else if(size == dnx->mmio_size) {
 			vma->vm_pgoff = (size_t)dnx->base_reg >> PAGE_SHIFT;
 		}
 		else if(size == 0x08000000) {
@@ -366,14 +533,61 @@ int dnx_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 }
 
-#ifdef DEBUG
-void dnx_gem_free_object(struct drm_gem_object *obj)
+static atomic64_t dnx_client_ids = ATOMIC64_INIT(0);
+
+static int dnx_open(struct drm_device *dev, struct drm_file *file)
 {
-	dev_dbg(obj->dev->dev, "freeing bo 0x%p kref=%d\n", obj, obj->refcount.refcount.counter);
-	drm_gem_cma_free_object(obj);
+	struct dnx_file_priv *priv;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if(!priv)
+		return -ENOMEM;
+
+	kref_init(&priv->ref);
+	priv->id = atomic64_inc_return(&dnx_client_ids);
+	spin_lock_init(&priv->queue_lock);
+	idr_init(&priv->queues);
+	spin_lock_init(&priv->job_lock);
+	idr_init(&priv->job_idr);
+	mutex_init(&priv->slab_lock);
+	INIT_LIST_HEAD(&priv->slabs);
+	dnx_gpu_client_add(dev->dev_private, priv);
+	file->driver_priv = priv;
+
+	return 0;
 }
-#endif
 
+static void dnx_postclose(struct drm_device *dev, struct drm_file *file)
+{
+	dnx_gpu_client_remove(dev->dev_private, file->driver_priv);
+	dnx_submitqueue_close_all(file->driver_priv);
+	dnx_job_close_all(file->driver_priv);
+	dnx_file_priv_put(file->driver_priv);
+}
+
+void dnx_file_priv_release(struct kref *ref)
+{
+	struct dnx_file_priv *priv = container_of(ref, struct dnx_file_priv, ref);
+
+	/* empty slabs are freed right away and bos hold a reference */
+	WARN_ON(!list_empty(&priv->slabs));
+	kfree(priv);
+}
+
+/* Usage in the common drm fdinfo format, the busy time grows as jobs retire */
+static void dnx_show_fdinfo(struct seq_file *m, struct file *f)
+{
+	struct drm_file *file = f->private_data;
+	struct dnx_file_priv *priv = file->driver_priv;
+
+	seq_printf(m, "drm-driver:\t%s\n", file->minor->dev->driver->name);
+	seq_printf(m, "drm-client-id:\t%llu\n", priv->id);
+	seq_printf(m, "drm-engine-dnx:\t%llu ns\n",
+			(u64)atomic64_read(&priv->busy_ns));
+	seq_printf(m, "drm-memory-cma:\t%llu KiB\n",
+			(u64)atomic64_read(&priv->mem) >> 10);
+	seq_printf(m, "dnx-jobs:\t%llu\n", (u64)atomic64_read(&priv->jobs));
+}
 
 static const struct file_operations dnx_fops = {
   .owner          = THIS_MODULE,
@@ -387,21 +601,22 @@ static const struct file_operations dnx_fops = {
   .read           = drm_read,
   .llseek         = no_llseek,
   .mmap           = dnx_mmap,
+  .show_fdinfo    = dnx_show_fdinfo,
 };
 
 static struct drm_driver dnx_driver = {
   .driver_features           = DRIVER_HAVE_IRQ | DRIVER_GEM | DRIVER_PRIME | DRIVER_RENDER,
-#ifdef DEBUG
+  .open                      = dnx_open,
+  .postclose                 = dnx_postclose,
+  .gem_create_object         = dnx_gem_create_object,
   .gem_free_object           = dnx_gem_free_object,
-#else
-  .gem_free_object           = drm_gem_cma_free_object,
-#endif
   .prime_handle_to_fd        = drm_gem_prime_handle_to_fd,
   .prime_fd_to_handle        = drm_gem_prime_fd_to_handle,
   .gem_prime_import          = drm_gem_prime_import,
-  .gem_prime_export          = drm_gem_prime_export,
+  .gem_prime_export          = dnx_gem_prime_export,
   .gem_prime_get_sg_table    = drm_gem_cma_prime_get_sg_table,
-  .gem_prime_import_sg_table = drm_gem_cma_prime_import_sg_table,
+  .gem_prime_import_sg_table = dnx_gem_prime_import_sg_table,
+  .gem_prime_res_obj         = dnx_gem_prime_res_obj,
   .gem_prime_vmap            = drm_gem_cma_prime_vmap,
   .gem_prime_vunmap          = drm_gem_cma_prime_vunmap,
   .gem_prime_mmap            = drm_gem_cma_prime_mmap,
@@ -414,7 +629,7 @@ static struct drm_driver dnx_driver = {
   .debugfs_cleanup           = dnx_debugfs_cleanup,
 #endif
   .ioctls = dnx_ioctls,
-  .num_ioctls = DRM_DNX_NUM_IOCTLS,
+  .num_ioctls = DRM_DNX_EXT_NUM_IOCTLS,
   .fops  = &dnx_fops,
   .name  = "tes-dnx",
   .desc  = "tes-dnx DRM",
@@ -441,35 +656,35 @@ static const struct dev_pm_ops dnx_pm_ops = {
   SET_SYSTEM_SLEEP_PM_OPS(dnx_pm_suspend, dnx_pm_resume)
 };
 
+/* Undoes the irq request of dnx_probe(), no handler runs afterwards. */
+static void dnx_free_irq(struct dnx_device *dnx)
+{
+	if(dnx->emu)
+		dnx_emu_fini(dnx->emu);
+	else
+		devm_free_irq(dnx->dev, dnx->irq, dnx);
+}
+
 static int dnx_remove(struct platform_device *pdev) {
   struct dnx_device *dnx = platform_get_drvdata(pdev);
   struct drm_device *ddev = dnx->drm;
 
   drm_dev_unregister(ddev);
+  dnx_free_irq(dnx);
+  dnx_gpu_release(dnx);
+  dnx_gem_cache_fini(&dnx->bo_cache);
   drm_dev_unref(ddev);
 
   return 0;
 }
 
-static int dnx_probe(struct platform_device *pdev) {
-	struct dnx_device *dnx;
-	struct drm_device *ddev;
+/* Maps the registers, sets up the CMA pool and gets the irq of the core. */
+static int dnx_probe_hw(struct platform_device *pdev, struct dnx_device *dnx)
+{
 	struct resource *mem;
-	struct device_node *np = pdev->dev.of_node;
-	dnx_config_ver_t version;
-	dnx_config_1_t config1;
+	struct device_node *np;
 	int ret = 0;
 
-	dnx = devm_kzalloc(&pdev->dev, sizeof(*dnx), GFP_KERNEL);
-	if(!dnx)
-		return -ENOMEM;
-
-	mutex_init(&dnx->lock);
-	spin_lock_init(&dnx->stc_lock);
-	init_waitqueue_head(&dnx->fence_waitq);
-
-	dnx->recover = recover ? true : false;
-
 	mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if(!mem)
 	{
@@ -507,6 +722,65 @@ static int dnx_probe(struct platform_device *pdev) {
 		return dnx->irq;
 	}
 
+	return 0;
+}
+
+/* The emulated core executes streams from the ring and linked bos by their
+ * bus addresses, which are 32 bit wide. */
+static int dnx_probe_emu(struct platform_device *pdev, struct dnx_device *dnx)
+{
+	int ret;
+
+	ret = dma_coerce_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32));
+	if(ret)
+		return ret;
+
+	dnx->emu = dnx_emu_new(&pdev->dev, dnx);
+	if(!dnx->emu)
+		return -ENOMEM;
+
+	dev_info(&pdev->dev, "Emulating D/AVE NX, %u ns per command\n",
+			dnx_emu_cmd_ns);
+
+	return 0;
+}
+
+static int dnx_probe(struct platform_device *pdev) {
+	struct dnx_device *dnx;
+	struct drm_device *ddev;
+	dnx_config_ver_t version;
+	dnx_config_1_t config1;
+	int ret = 0;
+
+	dnx = devm_kzalloc(&pdev->dev, sizeof(*dnx), GFP_KERNEL);
+	if(!dnx)
+		return -ENOMEM;
+
+	mutex_init(&dnx->lock);
+	spin_lock_init(&dnx->stc_lock);
+	init_waitqueue_head(&dnx->fence_waitq);
+
+	dnx->recover = recover ? true : false;
+
+	if(ring_pages <= 0) {
+		dev_err(&pdev->dev, "invalid ring buffer size: %d pages\n", ring_pages);
+		return -EINVAL;
+	}
+	dnx->ring_size = ring_pages * PAGE_SIZE;
+
+	if(hw_window <= 0 || hw_window > DNX_SCHED_WINDOW_MAX) {
+		dev_err(&pdev->dev, "invalid hw window: %d jobs\n", hw_window);
+		return -EINVAL;
+	}
+	dnx->sched_window = hw_window;
+
+	if(emulate)
+		ret = dnx_probe_emu(pdev, dnx);
+	else
+		ret = dnx_probe_hw(pdev, dnx);
+	if(ret)
+		return ret;
+
 	/* Validate HW */
 	version.m_data = dnx_reg_read(dnx, DNX_REG_CONTROL_VERSION);
 	if(version.bits.m_device != 0xd5) {
@@ -520,6 +794,7 @@ static int dnx_probe(struct platform_device *pdev) {
 	dev_info(&pdev->dev, "\tALUs: %u\n", config1.bits.m_shader_alu_count*4);
 	dev_info(&pdev->dev, "\tTexture units: %u\n", config1.bits.m_tex_units_count);
 	dev_info(&pdev->dev, "\tAuto recover: %s\n", recover ? "enabled" : "disabled");
+	dev_info(&pdev->dev, "\tRing buffer: %d pages\n", ring_pages);
 
 	if(DNX_HWVERSION != version.bits.m_hwver) {
 		dev_err(&pdev->dev, "unsupported D/AVE NX hardware version (required: %u)\n", DNX_HWVERSION);
@@ -537,28 +812,46 @@ static int dnx_probe(struct platform_device *pdev) {
 
 	platform_set_drvdata(pdev, dnx);
 
-	dnx_gpu_init(dnx);
+	ret = dnx_gpu_init(dnx);
+	if(ret)
+		goto error_unref;
+
+	ret = dnx_gem_cache_init(&dnx->bo_cache, dnx->dev);
+	if(ret)
+		goto error_gpu;
 
 	/* setup debug facility */
 	spin_lock_init(&dnx->debug_irq_slck);
 	init_waitqueue_head(&dnx->debug_irq_waitq);
 
+	spin_lock_init(&dnx->irq_lock);
+
 	/* Enable IRQ handler after HW and device object was set up properly */
-	ret = devm_request_irq(dnx->dev, dnx->irq, irq_handler, 0, dev_name(dnx->dev), dnx);
+	if(dnx->emu)
+		ret = dnx_emu_request_irq(dnx->emu, irq_handler, irq_thread);
+	else
+		ret = devm_request_threaded_irq(dnx->dev, dnx->irq, irq_handler,
+				irq_thread, 0, dev_name(dnx->dev), dnx);
 	if(ret) {
 		dev_err(&pdev->dev, "failed to request IRQ %u: %d\n", dnx->irq, ret);
-		return ret;
+		goto error_cache;
 	}
 
 	/* Register the DRM device. */
 	ret = drm_dev_register(ddev, 0);
 	if (ret)
-		goto error;
+		goto error_irq;
 
 	return 0;
 
-error:
-	dnx_remove(pdev);
+error_irq:
+	dnx_free_irq(dnx);
+error_cache:
+	dnx_gem_cache_fini(&dnx->bo_cache);
+error_gpu:
+	dnx_gpu_release(dnx);
+error_unref:
+	drm_dev_unref(ddev);
 
 	return ret;
 }
@@ -573,7 +866,44 @@ static struct platform_driver dnx_platform_driver = {
   },
   .id_table = dnx_id_table,
 };
-module_platform_driver(dnx_platform_driver);
+
+static int __init dnx_init(void)
+{
+	int ret;
+
+	ret = dnx_gpu_cache_init();
+	if(ret)
+		return ret;
+
+	ret = platform_driver_register(&dnx_platform_driver);
+	if(ret) {
+		dnx_gpu_cache_fini();
+		return ret;
+	}
+
+	/* no device tree node for the emulation, bind to a device of our own */
+	if(emulate) {
+		dnx_emu_pdev = platform_device_register_simple("dnx", -1, NULL, 0);
+		if(IS_ERR(dnx_emu_pdev)) {
+			ret = PTR_ERR(dnx_emu_pdev);
+			dnx_emu_pdev = NULL;
+			platform_driver_unregister(&dnx_platform_driver);
+			dnx_gpu_cache_fini();
+		}
+	}
+
+	return ret;
+}
+module_init(dnx_init);
+
+static void __exit dnx_exit(void)
+{
+	if(dnx_emu_pdev)
+		platform_device_unregister(dnx_emu_pdev);
+	platform_driver_unregister(&dnx_platform_driver);
+	dnx_gpu_cache_fini();
+}
+module_exit(dnx_exit);
 
 MODULE_AUTHOR("Christian Thaler <christian.thaler@tes-dst.com>");
 MODULE_DESCRIPTION("D/AVE NX DRM Driver");
@@ -1,9 +1,12 @@
 #ifndef __DNX_DRV_H__
 #define __DNX_DRV_H__
 
+#include <linux/idr.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
 #include <drm/drmP.h>
-#include <drm/dnx_drm.h>
+#include "dnx_drm_ext.h"
 
 #include "nx_types.h"
 
@@ -25,11 +28,87 @@
 struct dnx_device;
 
 
+/* one scheduler queue per DNX_SUBMITQUEUE_PRIO_x */
+#define DNX_SCHED_PRIOS (DNX_SUBMITQUEUE_PRIO_HIGH + 1)
+
+/* per drm_file state, lives on while the file's jobs and bos do */
+struct dnx_file_priv {
+	struct kref ref;
+	u64 id;
+	atomic64_t jobs;    /* submitted jobs */
+	atomic64_t busy_ns; /* execution time of retired jobs */
+	atomic64_t mem;     /* bytes of live bos created with GEM_NEW */
+	spinlock_t queue_lock;
+	struct idr queues;  /* submit queues, see dnx_submitqueue.c */
+	spinlock_t job_lock;
+	struct idr job_idr; /* persistent jobs, see dnx_gem_submit.c */
+
+	/* Fair share, protected by the device's lock */
+	struct list_head client_node; /* dnx_device's client_list while open */
+	u64 fence_context;  /* first of DNX_SCHED_PRIOS contexts */
+	u32 fence_seqno[DNX_SCHED_PRIOS];
+	unsigned int sched_queued; /* cmdbufs waiting in the scheduler */
+	unsigned long sched_blocked; /* sched_scans value of the last pick
+	                              * that found its oldest cmdbuf waiting */
+	atomic64_t vruntime; /* ns, charged on linking, corrected on retire */
+
+	/* slabs of small bos, see dnx_gem_slab.c */
+	struct mutex slab_lock;
+	struct list_head slabs;
+	unsigned int nr_slabs;
+};
+
+void dnx_file_priv_release(struct kref *ref);
+
+static inline struct dnx_file_priv *dnx_file_priv_get(
+		struct dnx_file_priv *priv)
+{
+	kref_get(&priv->ref);
+	return priv;
+}
+
+static inline void dnx_file_priv_put(struct dnx_file_priv *priv)
+{
+	kref_put(&priv->ref, dnx_file_priv_release);
+}
+
+
 u32 dnx_reg_read(struct dnx_device *dnx, u32 reg);
 void dnx_reg_write(struct dnx_device *dnx, u32 reg, u32 val);
+void dnx_irq_disable(struct dnx_device *dnx);
+void dnx_irq_enable(struct dnx_device *dnx);
+
+extern unsigned int dnx_wait_spin_us;
+extern unsigned int dnx_hang_timeout_ms;
+extern unsigned int dnx_bo_cache_kb;
+extern unsigned int dnx_emu_cmd_ns;
+
+#define TS(t) ((struct timespec){ \
+	.tv_sec = (t).tv_sec, \
+	.tv_nsec = (t).tv_nsec \
+})
 
 int dnx_ioctl_gem_submit(struct drm_device *dev, void *data,
 		struct drm_file *file);
+int dnx_ioctl_gem_submit_ext(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_gem_submit_batch(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_job_new(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_job_close(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_job_submit(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_submitqueue_new(struct drm_device *dev, void *data,
+		struct drm_file *file);
+int dnx_ioctl_submitqueue_close(struct drm_device *dev, void *data,
+		struct drm_file *file);
+
+int dnx_submitqueue_prio(struct dnx_file_priv *priv, u32 id,
+		unsigned int *prio);
+void dnx_submitqueue_close_all(struct dnx_file_priv *priv);
+void dnx_job_close_all(struct dnx_file_priv *priv);
 
 /*
  * Return the storage size of a structure with a variable length array.
@@ -0,0 +1,351 @@
+#include "dnx_emu.h"
+
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include "dnx_drv.h"
+#include "dnx_gem.h"
+#include "dnx_gpu.h"
+#include "nx_register_address.h"
+#include "nx_types.h"
+
+
+static void emu_set_ids(struct dnx_emu *emu)
+{
+	dnx_config_ver_t version;
+	dnx_config_1_t config1;
+
+	version.m_data = 0;
+	version.bits.m_device = 0xd5;
+	version.bits.m_hwver = DNX_HWVERSION;
+	emu->regs[DNX_REG_CONTROL_VERSION] = version.m_data;
+
+	config1.m_data = 0;
+	config1.bits.m_shader_count = 1;
+	config1.bits.m_shader_alu_count = 1;
+	config1.bits.m_tex_units_count = 1;
+	emu->regs[DNX_REG_CONTROL_CONFIG_1] = config1.m_data;
+}
+
+
+static void emu_reset(struct dnx_emu *emu)
+{
+	memset(emu->regs, 0, sizeof(emu->regs));
+	emu_set_ids(emu);
+
+	emu->running = false;
+	emu->pc = 0;
+	emu->seg_vaddr = NULL;
+}
+
+
+static bool emu_irq_line(struct dnx_emu *emu)
+{
+	return READ_ONCE(emu->regs[DNX_REG_CONTROL_IRQ_STATE]) &
+		READ_ONCE(emu->regs[DNX_REG_CONTROL_IRQ_MASK]);
+}
+
+
+static bool emu_busy(struct dnx_emu *emu)
+{
+	return READ_ONCE(emu->running) ||
+		(emu_irq_line(emu) && !READ_ONCE(emu->irq_disabled));
+}
+
+
+/* Reads the word at bus address addr from the ring or a bo of a cmdbuf
+ * linked into the ring. */
+static bool emu_fetch(struct dnx_emu *emu, u32 addr, u32 *word)
+{
+	struct dnx_device *dnx = emu->dnx;
+	struct dnx_ringbuf *ring = dnx->buffer;
+
+	if(addr & (sizeof(u32) - 1))
+		return false;
+
+	if(!emu->seg_vaddr || addr - emu->seg_start >= emu->seg_size) {
+		struct dnx_cmdbuf_bo *entry;
+
+		emu->seg_vaddr = NULL;
+
+		if(addr - ring->paddr < ring->size) {
+			emu->seg_start = ring->paddr;
+			emu->seg_size = ring->size;
+			emu->seg_vaddr = ring->vaddr;
+		}
+		else {
+			spin_lock(&dnx->bo_tree_lock);
+			entry = dnx_gpu_lookup_bo(dnx, addr, NULL);
+			if(entry && entry->obj->vaddr) {
+				emu->seg_start = entry->obj->paddr;
+				emu->seg_size = to_dnx_bo(&entry->obj->base)->size;
+				emu->seg_vaddr = entry->obj->vaddr;
+			}
+			spin_unlock(&dnx->bo_tree_lock);
+		}
+
+		if(!emu->seg_vaddr)
+			return false;
+	}
+
+	*word = READ_ONCE(emu->seg_vaddr[(addr - emu->seg_start) / sizeof(u32)]);
+
+	return true;
+}
+
+
+static void emu_stop(struct dnx_emu *emu, u32 irqs)
+{
+	emu->running = false;
+	emu->seg_vaddr = NULL;
+	emu->regs[DNX_REG_CONTROL_BUSY] &= ~DNX_BUSY_MASK_CTRL;
+	emu->regs[DNX_REG_CONTROL_STREAM_POS] = emu->pc;
+	emu->regs[DNX_REG_CONTROL_IRQ_STATE] |= irqs;
+}
+
+
+/* Register write of the stream, only the sync raises an irq. */
+static void emu_stream_write(struct dnx_emu *emu, u32 reg, u32 val)
+{
+	if(reg < DNX_EMU_REGS)
+		emu->regs[reg] = val;
+
+	if(reg == DNX_REG_CONTROL_SYNC_0)
+		emu->regs[DNX_REG_CONTROL_IRQ_STATE] |= DNX_IRQ_MASK_STREAM_SYNC;
+}
+
+
+/* Executes the command at pc. An END stops at its own address, so the STC
+ * can be restarted there once it was patched into a JMP. */
+static void emu_exec(struct dnx_emu *emu)
+{
+	dnx_stream_cmd_word_t cmd;
+	u32 arg, i;
+
+	if(!emu_fetch(emu, emu->pc, &cmd.m_data))
+		goto fault;
+
+	switch(cmd.bits.m_cmd) {
+	case DNX_STREAM_CMD_END:
+		emu_stop(emu, DNX_IRQ_MASK_STREAM_DONE);
+		return;
+
+	case DNX_STREAM_CMD_JMP:
+		if(!emu_fetch(emu, emu->pc + sizeof(u32), &arg))
+			goto fault;
+		emu->pc = arg;
+		/* the bo left may be freed once its job is retired */
+		emu->seg_vaddr = NULL;
+		break;
+
+	case DNX_STREAM_CMD_WRITE:
+		for(i = 0; i < cmd.bits.m_count; i++) {
+			if(!emu_fetch(emu, emu->pc + (i + 1) * sizeof(u32), &arg))
+				goto fault;
+			emu_stream_write(emu, cmd.bits.m_addr + i, arg);
+		}
+		emu->pc += (cmd.bits.m_count + 1) * sizeof(u32);
+		break;
+
+	default:
+		emu_stop(emu, DNX_IRQ_MASK_STREAM_ERR);
+		return;
+	}
+
+	emu->regs[DNX_REG_CONTROL_STREAM_POS] = emu->pc;
+	return;
+
+fault:
+	emu->faults++;
+	emu_stop(emu, DNX_IRQ_MASK_STREAM_ERR);
+}
+
+
+/* Calls the handlers like the irq core would for a level triggered line. */
+static void emu_deliver_irq(struct dnx_emu *emu)
+{
+	irqreturn_t ret;
+
+	if(!emu_irq_line(emu))
+		return;
+
+	mutex_lock(&emu->irq_mutex);
+	if(!emu->irq_disabled && emu_irq_line(emu)) {
+		local_irq_disable();
+		ret = emu->handler(0, emu->dnx);
+		local_irq_enable();
+
+		if(ret == IRQ_WAKE_THREAD)
+			emu->thread_fn(0, emu->dnx);
+	}
+	mutex_unlock(&emu->irq_mutex);
+}
+
+
+static void emu_delay(unsigned int ns)
+{
+	if(ns < 10 * NSEC_PER_USEC)
+		ndelay(ns);
+	else
+		usleep_range(ns / NSEC_PER_USEC, ns / NSEC_PER_USEC + 1);
+}
+
+
+static int emu_thread(void *data)
+{
+	struct dnx_emu *emu = data;
+	unsigned long flags;
+	bool ran;
+
+	while(!kthread_should_stop()) {
+		wait_event_interruptible(emu->waitq,
+				emu_busy(emu) || kthread_should_stop());
+
+		spin_lock_irqsave(&emu->lock, flags);
+		ran = emu->running;
+		if(ran) {
+			emu_exec(emu);
+			emu->cmds++;
+		}
+		spin_unlock_irqrestore(&emu->lock, flags);
+
+		emu_deliver_irq(emu);
+
+		if(ran && dnx_emu_cmd_ns)
+			emu_delay(dnx_emu_cmd_ns);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+
+struct dnx_emu *dnx_emu_new(struct device *dev, struct dnx_device *dnx)
+{
+	struct dnx_emu *emu;
+
+	BUILD_BUG_ON(DNX_REG_CONTROL_IRQ_TRIGGER >= DNX_EMU_REGS);
+
+	emu = devm_kzalloc(dev, sizeof(*emu), GFP_KERNEL);
+	if(!emu)
+		return NULL;
+
+	emu->dnx = dnx;
+	spin_lock_init(&emu->lock);
+	init_waitqueue_head(&emu->waitq);
+	mutex_init(&emu->irq_mutex);
+	emu_reset(emu);
+
+	return emu;
+}
+
+
+/* Starts the STC thread, which delivers irqs from now on. */
+int dnx_emu_request_irq(struct dnx_emu *emu, irq_handler_t handler,
+		irq_handler_t thread_fn)
+{
+	struct task_struct *thread;
+
+	emu->handler = handler;
+	emu->thread_fn = thread_fn;
+
+	thread = kthread_run(emu_thread, emu, "dnx-emu");
+	if(IS_ERR(thread))
+		return PTR_ERR(thread);
+	emu->thread = thread;
+
+	return 0;
+}
+
+
+void dnx_emu_fini(struct dnx_emu *emu)
+{
+	if(emu->thread)
+		kthread_stop(emu->thread);
+	emu->thread = NULL;
+}
+
+
+u32 dnx_emu_reg_read(struct dnx_emu *emu, u32 reg)
+{
+	unsigned long flags;
+	u32 val = 0;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	if(reg < DNX_EMU_REGS)
+		val = emu->regs[reg];
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	return val;
+}
+
+
+void dnx_emu_reg_write(struct dnx_emu *emu, u32 reg, u32 val)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	switch(reg) {
+	case DNX_REG_CONTROL_VERSION:
+	case DNX_REG_CONTROL_CONFIG_1:
+	case DNX_REG_CONTROL_CONFIG_2:
+	case DNX_REG_CONTROL_CONFIG_3:
+	case DNX_REG_CONTROL_BUSY:
+	case DNX_REG_CONTROL_STREAM_POS:
+		/* read only */
+		break;
+
+	case DNX_REG_CONTROL_IRQ_STATE:
+		emu->regs[reg] &= ~val;
+		break;
+
+	case DNX_REG_CONTROL_IRQ_TRIGGER:
+		emu->regs[DNX_REG_CONTROL_IRQ_STATE] |=
+				val | DNX_IRQ_MASK_STREAM_SOFT;
+		break;
+
+	case DNX_REG_CONTROL_STREAM_ADDR:
+		emu->regs[reg] = val;
+		emu->regs[DNX_REG_CONTROL_STREAM_POS] = val;
+		emu->regs[DNX_REG_CONTROL_BUSY] |= DNX_BUSY_MASK_CTRL;
+		emu->pc = val;
+		emu->seg_vaddr = NULL;
+		emu->running = true;
+		break;
+
+	case DNX_REG_CONTROL_SOFT_RESET:
+		emu_reset(emu);
+		break;
+
+	default:
+		if(reg < DNX_EMU_REGS)
+			emu->regs[reg] = val;
+		break;
+	}
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	wake_up(&emu->waitq);
+}
+
+
+/* Like disable_irq(), waits for running handlers. */
+void dnx_emu_irq_disable(struct dnx_emu *emu)
+{
+	mutex_lock(&emu->irq_mutex);
+	emu->irq_disabled++;
+	mutex_unlock(&emu->irq_mutex);
+}
+
+
+void dnx_emu_irq_enable(struct dnx_emu *emu)
+{
+	mutex_lock(&emu->irq_mutex);
+	WARN_ON(!emu->irq_disabled);
+	emu->irq_disabled--;
+	mutex_unlock(&emu->irq_mutex);
+
+	wake_up(&emu->waitq);
+}
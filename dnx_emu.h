@@ -0,0 +1,59 @@
+#ifndef _DNX_EMU_H_
+#define _DNX_EMU_H_
+
+
+#include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+
+struct dnx_device;
+struct task_struct;
+
+
+/* control registers kept by the emulation, stream writes to others are
+ * dropped */
+#define DNX_EMU_REGS (256)
+#define DNX_EMU_CMD_NS (1000) /* default execution time of a command */
+
+/* Register file and stream controller of an emulated core. The STC runs in
+ * a kthread which also calls the irq handlers, as the irq line would. */
+struct dnx_emu {
+	struct dnx_device *dnx;
+
+	spinlock_t lock; /* protects the registers and the STC state */
+	u32 regs[DNX_EMU_REGS];
+	bool running;
+	u32 pc; /* bus address of the next command */
+
+	/* memory the STC currently fetches from, dropped on jumps */
+	dma_addr_t seg_start;
+	size_t seg_size;
+	u32 *seg_vaddr;
+
+	struct task_struct *thread;
+	wait_queue_head_t waitq;
+
+	struct mutex irq_mutex; /* held while the handlers run */
+	unsigned int irq_disabled; /* depth, protected by irq_mutex */
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+
+	unsigned long cmds; /* executed commands */
+	unsigned long faults; /* fetches outside the ring and linked bos */
+};
+
+
+struct dnx_emu *dnx_emu_new(struct device *dev, struct dnx_device *dnx);
+int dnx_emu_request_irq(struct dnx_emu *emu, irq_handler_t handler,
+		irq_handler_t thread_fn);
+void dnx_emu_fini(struct dnx_emu *emu);
+u32 dnx_emu_reg_read(struct dnx_emu *emu, u32 reg);
+void dnx_emu_reg_write(struct dnx_emu *emu, u32 reg, u32 val);
+void dnx_emu_irq_disable(struct dnx_emu *emu);
+void dnx_emu_irq_enable(struct dnx_emu *emu);
+
+
+#endif /* _DNX_EMU_H_ */
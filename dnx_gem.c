@@ -1,27 +1,366 @@
 #include "dnx_gem.h"
 
 #include <drm/drm_gem_cma_helper.h>
+#include <linux/dma-mapping.h>
+#include <linux/vmalloc.h>
 
+#include "dnx_drv.h"
+#include "dnx_gpu.h"
 
-struct drm_gem_object *dnx_gem_new(struct drm_device *dev, size_t unaligned_size, dma_addr_t *paddr)
+
+/* drm_gem_cma_create() hook to embed the CMA object in our own */
+struct drm_gem_object *dnx_gem_create_object(struct drm_device *dev, size_t size)
+{
+	struct dnx_gem_object *obj;
+
+	obj = kzalloc(sizeof(*obj), GFP_KERNEL);
+	if(!obj)
+		return NULL;
+
+	reservation_object_init(&obj->_resv);
+	obj->resv = &obj->_resv;
+	obj->size = size;
+	obj->caching = DNX_BO_WC;
+
+	return &obj->base.base;
+}
+
+
+/* Frees the memory of cached and uncached bos, drm_gem_cma_free_object()
+ * only knows write-combined memory. */
+static void dnx_gem_free_memory(struct dnx_gem_object *bo)
+{
+	struct device *dev = bo->base.base.dev->dev;
+	size_t size = bo->base.base.size;
+
+	if(!bo->base.vaddr)
+		return;
+
+	if(bo->caching == DNX_BO_CACHED) {
+		dma_unmap_page(dev, bo->dma, size, DMA_BIDIRECTIONAL);
+		vunmap(bo->base.vaddr);
+		dma_free_attrs(dev, size, bo->cookie, bo->base.paddr,
+				DMA_ATTR_NO_KERNEL_MAPPING);
+	}
+	else {
+		dma_free_coherent(dev, size, bo->base.vaddr, bo->base.paddr);
+	}
+
+	bo->base.vaddr = NULL;
+}
+
+
+/* Allocates cacheable memory. The kernel mapping is a vmap() with the same
+ * attributes as the linear mapping dma_alloc_attrs() leaves alone with
+ * DMA_ATTR_NO_KERNEL_MAPPING, the streaming mapping is only used for cache
+ * maintenance. */
+static int dnx_gem_alloc_cached(struct dnx_gem_object *bo, size_t size)
+{
+	struct device *dev = bo->base.base.dev->dev;
+	unsigned int i, nr_pages = size >> PAGE_SHIFT;
+	struct page **pages;
+	unsigned long pfn;
+
+	bo->cookie = dma_alloc_attrs(dev, size, &bo->base.paddr,
+			GFP_KERNEL | __GFP_NOWARN, DMA_ATTR_NO_KERNEL_MAPPING);
+	if(!bo->cookie)
+		return -ENOMEM;
+
+	/* CMA memory is not behind an IOMMU */
+	pfn = PHYS_PFN(bo->base.paddr);
+
+	pages = drm_malloc_ab(nr_pages, sizeof(*pages));
+	if(!pages)
+		goto error_free;
+	for(i = 0; i < nr_pages; i++)
+		pages[i] = pfn_to_page(pfn + i);
+
+	bo->base.vaddr = vmap(pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	drm_free_large(pages);
+	if(!bo->base.vaddr)
+		goto error_free;
+
+	bo->dma = dma_map_page(dev, pfn_to_page(pfn), 0, size,
+			DMA_BIDIRECTIONAL);
+	if(dma_mapping_error(dev, bo->dma))
+		goto error_vunmap;
+
+	return 0;
+
+error_vunmap:
+	vunmap(bo->base.vaddr);
+	bo->base.vaddr = NULL;
+error_free:
+	dma_free_attrs(dev, size, bo->cookie, bo->base.paddr,
+			DMA_ATTR_NO_KERNEL_MAPPING);
+	return -ENOMEM;
+}
+
+
+/* Same as drm_gem_cma_create(), but for cached or uncached memory. */
+static struct drm_gem_cma_object *dnx_gem_new_caching(struct drm_device *dev,
+	size_t size, u32 caching)
+{
+	struct drm_gem_object *obj;
+	struct dnx_gem_object *bo;
+	int ret;
+
+	obj = dnx_gem_create_object(dev, size);
+	if(!obj)
+		return ERR_PTR(-ENOMEM);
+
+	ret = drm_gem_object_init(dev, obj, size);
+	if(ret) {
+		kfree(to_dnx_bo(obj));
+		return ERR_PTR(ret);
+	}
+
+	bo = to_dnx_bo(obj);
+	bo->caching = caching;
+
+	if(caching == DNX_BO_CACHED) {
+		ret = dnx_gem_alloc_cached(bo, size);
+	}
+	else {
+		bo->base.vaddr = dma_alloc_coherent(dev->dev, size,
+				&bo->base.paddr, GFP_KERNEL | __GFP_NOWARN);
+		ret = bo->base.vaddr ? 0 : -ENOMEM;
+	}
+	if(ret == 0)
+		ret = drm_gem_create_mmap_offset(obj);
+	if(ret) {
+		/* frees the memory with the object */
+		drm_gem_object_unreference_unlocked(obj);
+		return ERR_PTR(ret);
+	}
+
+	return &bo->base;
+}
+
+
+void dnx_gem_free_object(struct drm_gem_object *obj)
+{
+	struct dnx_gem_object *bo = to_dnx_bo(obj);
+
+	dev_dbg(obj->dev->dev, "freeing bo 0x%p\n", obj);
+
+	if(bo->slab) {
+		dnx_gem_slab_free(bo);
+	}
+	else if(bo->caching != DNX_BO_WC) {
+		dnx_gem_free_memory(bo);
+	}
+	else if(bo->owner) {
+		struct drm_gem_cma_object *cma = &bo->base;
+		struct dnx_device *dnx = obj->dev->dev_private;
+
+		/* only bos of GEM_NEW have an owner, keep their memory */
+		if(dnx_gem_cache_put(&dnx->bo_cache, obj->size, cma->vaddr,
+				cma->paddr))
+			cma->vaddr = NULL;
+	}
+
+	if(bo->owner) {
+		atomic64_sub(bo->size, &bo->owner->mem);
+		dnx_file_priv_put(bo->owner);
+	}
+
+	reservation_object_fini(&bo->_resv);
+
+	/* frees bo as well, base is its first member, cached memory is left
+	 * alone as vaddr is cleared */
+	drm_gem_cma_free_object(obj);
+}
+
+
+/* Accounts a newly created bo to the client's memory usage. */
+void dnx_gem_set_owner(struct drm_gem_object *obj, struct dnx_file_priv *priv)
+{
+	struct dnx_gem_object *bo = to_dnx_bo(obj);
+
+	bo->owner = dnx_file_priv_get(priv);
+	atomic64_add(bo->size, &priv->mem);
+}
+
+
+struct drm_gem_object *dnx_gem_prime_import_sg_table(struct drm_device *dev,
+	struct dma_buf_attachment *attach, struct sg_table *sgt)
+{
+	struct drm_gem_object *obj;
+
+	obj = drm_gem_cma_prime_import_sg_table(dev, attach, sgt);
+	if(IS_ERR(obj))
+		return obj;
+
+	/* share implicit fences with the exporter */
+	to_dnx_bo(obj)->resv = attach->dmabuf->resv;
+
+	return obj;
+}
+
+
+/* Mappings of a slab bo expose its neighbours, keep it to its client. */
+struct dma_buf *dnx_gem_prime_export(struct drm_device *dev,
+	struct drm_gem_object *obj, int flags)
+{
+	struct dnx_gem_object *bo = to_dnx_bo(obj);
+
+	/* importers map and sync exported bos as write-combined CMA memory */
+	if(bo->slab || bo->caching != DNX_BO_WC)
+		return ERR_PTR(-EINVAL);
+
+	return drm_gem_prime_export(dev, obj, flags);
+}
+
+
+struct reservation_object *dnx_gem_prime_res_obj(struct drm_gem_object *obj)
+{
+	return to_dnx_bo(obj)->resv;
+}
+
+
+/* Same as drm_gem_cma_create(), but with memory from the bo cache. */
+static struct drm_gem_cma_object *dnx_gem_new_reused(struct drm_device *dev,
+	size_t size)
+{
+	struct dnx_device *dnx = dev->dev_private;
+	struct drm_gem_object *obj;
+	struct drm_gem_cma_object *cma;
+	void *vaddr;
+	dma_addr_t paddr;
+	int ret;
+
+	if(!dnx_gem_cache_get(&dnx->bo_cache, size, &vaddr, &paddr))
+		return NULL;
+
+	obj = dnx_gem_create_object(dev, size);
+	if(!obj)
+		goto error_cache;
+
+	ret = drm_gem_object_init(dev, obj, size);
+	if(ret) {
+		kfree(to_dnx_bo(obj));
+		goto error_cache;
+	}
+
+	cma = to_drm_gem_cma_obj(obj);
+	cma->vaddr = vaddr;
+	cma->paddr = paddr;
+
+	ret = drm_gem_create_mmap_offset(obj);
+	if(ret) {
+		/* frees the memory with the object */
+		drm_gem_object_unreference_unlocked(obj);
+		return ERR_PTR(ret);
+	}
+
+	return cma;
+
+error_cache:
+	dma_free_wc(dev->dev, size, vaddr, paddr);
+	return ERR_PTR(-ENOMEM);
+}
+
+
+static struct drm_gem_cma_object *dnx_gem_alloc(struct drm_device *dev,
+	size_t size, u32 caching)
+{
+	if(caching == DNX_BO_WC)
+		return drm_gem_cma_create(dev, size);
+
+	return dnx_gem_new_caching(dev, size, caching);
+}
+
+
+/* Allocates a bo for priv and accounts it to the client. Small bos of
+ * DNX_BO_SUBALLOC share slabs, others preferably use memory from the bo
+ * cache. Slabs and cache only hold write-combined memory, the default, so
+ * cached and uncached bos always get their own pages. The cache is dropped
+ * if CMA runs out. */
+struct drm_gem_object *dnx_gem_new(struct drm_device *dev, size_t unaligned_size,
+	u32 flags, struct dnx_file_priv *priv, dma_addr_t *paddr)
 {
+	struct dnx_device *dnx = dev->dev_private;
 	struct drm_gem_cma_object *obj;
+	size_t size = PAGE_ALIGN(unaligned_size);
+	u32 caching = flags & (DNX_BO_CACHED | DNX_BO_WC | DNX_BO_UNCACHED);
 
 	if(unaligned_size == 0)
 			return ERR_PTR(-EINVAL);
 
-	obj = drm_gem_cma_create(dev, unaligned_size);
+	if(!caching)
+		caching = DNX_BO_WC;
+	else if(hweight32(caching) > 1)
+		return ERR_PTR(-EINVAL);
+
+	if(caching != DNX_BO_WC)
+		obj = dnx_gem_alloc(dev, size, caching);
+	else if((flags & DNX_BO_SUBALLOC) && unaligned_size <= DNX_SLAB_MAX)
+		obj = dnx_gem_slab_new(dev, unaligned_size, priv);
+	else
+		obj = dnx_gem_new_reused(dev, size);
+	if(!obj)
+		obj = drm_gem_cma_create(dev, size);
+	if(IS_ERR(obj) && dnx_gem_cache_evict(&dnx->bo_cache, ULONG_MAX))
+		obj = dnx_gem_alloc(dev, size, caching);
 	if(IS_ERR(obj)) {
 		dev_err(dev->dev, "Failed to allocate from CMA\n");
 		return ERR_PTR(-ENOMEM);
 	}
 
+	dnx_gem_set_owner(&obj->base, priv);
 	*paddr = obj->paddr;
 
 	return &obj->base;
 }
 
 
+/* Same as drm_gem_cma_mmap(), slab bos map the pages they touch and cached
+ * bos get a cacheable mapping. */
+int dnx_gem_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct drm_gem_object *obj;
+	struct dnx_gem_object *bo;
+	int ret;
+
+	ret = drm_gem_mmap(filp, vma);
+	if(ret)
+		return ret;
+
+	obj = vma->vm_private_data;
+	bo = to_dnx_bo(obj);
+
+	/* dma_mmap_wc() remaps with pfns, not the pages drm_gem_mmap() set
+	 * up for */
+	vma->vm_flags &= ~VM_PFNMAP;
+
+	if(bo->slab) {
+		ret = dnx_gem_slab_mmap(bo, vma);
+	}
+	else if(bo->caching == DNX_BO_CACHED) {
+		vma->vm_pgoff = 0;
+		vma->vm_page_prot = vm_get_page_prot(vma->vm_flags);
+		ret = remap_pfn_range(vma, vma->vm_start,
+				PHYS_PFN(bo->base.paddr),
+				vma->vm_end - vma->vm_start, vma->vm_page_prot);
+	}
+	else if(bo->caching == DNX_BO_UNCACHED) {
+		vma->vm_pgoff = 0;
+		ret = dma_mmap_coherent(obj->dev->dev, vma, bo->base.vaddr,
+				bo->base.paddr, vma->vm_end - vma->vm_start);
+	}
+	else {
+		vma->vm_pgoff = 0;
+		ret = dma_mmap_wc(obj->dev->dev, vma, bo->base.vaddr,
+				bo->base.paddr, vma->vm_end - vma->vm_start);
+	}
+	if(ret)
+		drm_gem_vm_close(vma);
+
+	return ret;
+}
+
+
 int dnx_gem_mmap_offset(struct drm_gem_object *obj, u64 *offset)
 {
 	int ret;
@@ -35,3 +374,77 @@ int dnx_gem_mmap_offset(struct drm_gem_object *obj, u64 *offset)
 
 	return ret;
 }
+
+
+/* Waits until the GPU is done with obj: CPU reads have to wait for GPU
+ * writes, CPU writes for all GPU accesses. A cached bo prepared for writing
+ * is cleaned by the next CPU_FINI or submit. */
+int dnx_gem_cpu_prep(struct drm_gem_object *obj, u32 op, struct timespec *timeout)
+{
+	struct dnx_gem_object *bo = to_dnx_bo(obj);
+	bool write = !!(op & DNX_PREP_WRITE);
+	long ret;
+
+	if(op & DNX_PREP_NOSYNC) {
+		if(!reservation_object_test_signaled_rcu(bo->resv, write)) {
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+	else {
+		ret = reservation_object_wait_timeout_rcu(bo->resv, write, true,
+				dnx_timeout_to_jiffies(timeout));
+		if(ret == 0) {
+			ret = -ETIMEDOUT;
+			goto out;
+		}
+		if(ret < 0)
+			goto out;
+	}
+
+	/* drop lines the CPU may have fetched while the GPU was writing, the
+	 * invalidate would drop writes of an earlier PREP_WRITE as well */
+	if(bo->caching == DNX_BO_CACHED) {
+		dnx_gem_sync_dirty(bo);
+		dma_sync_single_for_cpu(obj->dev->dev, bo->dma, obj->size,
+				DMA_FROM_DEVICE);
+	}
+	ret = 0;
+
+out:
+	if(write && bo->caching == DNX_BO_CACHED)
+		atomic_set(&bo->cpu_dirty, 1);
+
+	return ret;
+}
+
+
+/* Writes back CPU writes to a cached bo between offset and offset + size.
+ * Write-combined and uncached memory need nothing beyond the barrier in the
+ * ring update. */
+void dnx_gem_sync_for_device(struct dnx_gem_object *bo, size_t offset,
+	size_t size)
+{
+	if(bo->caching != DNX_BO_CACHED)
+		return;
+
+	dma_sync_single_range_for_device(bo->base.base.dev->dev, bo->dma,
+			offset, size, DMA_TO_DEVICE);
+}
+
+
+/* Cleans a cached bo if the CPU may have written it since the last time,
+ * submits call it for each bo instead of syncing all of them. */
+void dnx_gem_sync_dirty(struct dnx_gem_object *bo)
+{
+	if(atomic_xchg(&bo->cpu_dirty, 0))
+		dnx_gem_sync_for_device(bo, 0, bo->base.base.size);
+}
+
+
+int dnx_gem_cpu_fini(struct drm_gem_object *obj)
+{
+	dnx_gem_sync_dirty(to_dnx_bo(obj));
+
+	return 0;
+}
@@ -4,10 +4,71 @@
 
 #include <drm/drmP.h>
 #include <drm/drm_gem_cma_helper.h>
+#include <linux/fence.h>
+#include <linux/reservation.h>
+#include <linux/sizes.h>
 
+#include "dnx_drv.h"
 
-struct drm_gem_object *dnx_gem_new(struct drm_device *dev, size_t unaligned_size, dma_addr_t *paddr);
+
+/* small bos of DNX_BO_SUBALLOC are carved from per client slabs */
+#define DNX_SLAB_SIZE (SZ_64K)
+#define DNX_SLAB_ALIGN (64)
+#define DNX_SLAB_MAX (PAGE_SIZE / 2)
+
+struct dnx_gem_slab;
+
+struct dnx_gem_object {
+	struct drm_gem_cma_object base;
+
+	/* bytes usable by the GPU, base's size is page aligned */
+	size_t size;
+
+	/* slab the bo is carved from, base's size covers the pages it touches */
+	struct dnx_gem_slab *slab;
+
+	/* CPU mapping type, DNX_BO_CACHED, DNX_BO_WC or DNX_BO_UNCACHED */
+	u32 caching;
+	void *cookie;     /* of dma_alloc_attrs() for cached bos */
+	dma_addr_t dma;   /* streaming mapping for cache maintenance */
+	atomic_t cpu_dirty; /* CPU_PREP for writing, not cleaned since */
+
+	/* points to the dma-buf's reservation object for imported objects */
+	struct reservation_object *resv;
+	struct reservation_object _resv;
+
+	/* client whose memory usage the bo is accounted to */
+	struct dnx_file_priv *owner;
+};
+
+static inline struct dnx_gem_object *to_dnx_bo(struct drm_gem_object *obj)
+{
+	return container_of(to_drm_gem_cma_obj(obj), struct dnx_gem_object, base);
+}
+
+
+struct drm_gem_object *dnx_gem_create_object(struct drm_device *dev, size_t size);
+void dnx_gem_free_object(struct drm_gem_object *obj);
+void dnx_gem_set_owner(struct drm_gem_object *obj, struct dnx_file_priv *priv);
+struct drm_gem_object *dnx_gem_prime_import_sg_table(struct drm_device *dev,
+	struct dma_buf_attachment *attach, struct sg_table *sgt);
+struct reservation_object *dnx_gem_prime_res_obj(struct drm_gem_object *obj);
+struct dma_buf *dnx_gem_prime_export(struct drm_device *dev,
+	struct drm_gem_object *obj, int flags);
+struct drm_gem_object *dnx_gem_new(struct drm_device *dev, size_t unaligned_size,
+	u32 flags, struct dnx_file_priv *priv, dma_addr_t *paddr);
+int dnx_gem_mmap(struct file *filp, struct vm_area_struct *vma);
 int dnx_gem_mmap_offset(struct drm_gem_object *obj, u64 *offset);
+int dnx_gem_cpu_prep(struct drm_gem_object *obj, u32 op, struct timespec *timeout);
+int dnx_gem_cpu_fini(struct drm_gem_object *obj);
+void dnx_gem_sync_for_device(struct dnx_gem_object *bo, size_t offset,
+	size_t size);
+void dnx_gem_sync_dirty(struct dnx_gem_object *bo);
+
+struct drm_gem_cma_object *dnx_gem_slab_new(struct drm_device *dev,
+	size_t size, struct dnx_file_priv *priv);
+void dnx_gem_slab_free(struct dnx_gem_object *bo);
+int dnx_gem_slab_mmap(struct dnx_gem_object *bo, struct vm_area_struct *vma);
 
 
 #endif /* _DNX_GEM_H_ */
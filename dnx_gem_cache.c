@@ -0,0 +1,235 @@
+#include "dnx_gem_cache.h"
+
+#include <linux/dma-mapping.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "dnx_drv.h"
+
+
+struct dnx_gem_cache_entry {
+	struct list_head bucket_node;
+	struct list_head lru_node;
+	void *vaddr;
+	dma_addr_t paddr;
+	size_t size;
+};
+
+
+static unsigned int cache_bucket(size_t size)
+{
+	unsigned int order = ilog2(size >> PAGE_SHIFT);
+
+	return min_t(unsigned int, order, DNX_GEM_CACHE_BUCKETS - 1);
+}
+
+
+static void cache_unlink(struct dnx_gem_cache *cache,
+		struct dnx_gem_cache_entry *entry)
+{
+	list_del(&entry->bucket_node);
+	list_del(&entry->lru_node);
+	cache->size -= entry->size;
+	cache->count--;
+}
+
+
+static void cache_free_list(struct dnx_gem_cache *cache,
+		struct list_head *list)
+{
+	struct dnx_gem_cache_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, list, lru_node) {
+		dma_free_wc(cache->dev, entry->size, entry->vaddr,
+				entry->paddr);
+		kfree(entry);
+	}
+}
+
+
+/* Frees up to nr of the oldest cached buffers, returns how many. */
+unsigned long dnx_gem_cache_evict(struct dnx_gem_cache *cache,
+		unsigned long nr)
+{
+	struct dnx_gem_cache_entry *entry, *tmp;
+	unsigned long freed = 0;
+	LIST_HEAD(evicted);
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(entry, tmp, &cache->lru, lru_node) {
+		if(freed == nr)
+			break;
+		cache_unlink(cache, entry);
+		list_add_tail(&entry->lru_node, &evicted);
+		freed++;
+	}
+	cache->evictions += freed;
+	mutex_unlock(&cache->lock);
+
+	cache_free_list(cache, &evicted);
+
+	return freed;
+}
+
+
+/* Takes a cached buffer of exactly size bytes, cleared like fresh memory. */
+bool dnx_gem_cache_get(struct dnx_gem_cache *cache, size_t size,
+		void **vaddr, dma_addr_t *paddr)
+{
+	struct dnx_gem_cache_entry *entry, *found = NULL;
+	struct list_head *bucket = &cache->buckets[cache_bucket(size)];
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry(entry, bucket, bucket_node) {
+		if(entry->size == size) {
+			found = entry;
+			cache_unlink(cache, found);
+			break;
+		}
+	}
+	if(found)
+		cache->hits++;
+	else
+		cache->misses++;
+	mutex_unlock(&cache->lock);
+
+	if(!found)
+		return false;
+
+	/* GEM_NEW always returned zeroed bos, even to their last user */
+	memset(found->vaddr, 0, size);
+
+	*vaddr = found->vaddr;
+	*paddr = found->paddr;
+	kfree(found);
+
+	return true;
+}
+
+
+/* Keeps the backing of a freed bo, returns false if the caller has to free
+ * it. The oldest buffers make room if the cache is full. */
+bool dnx_gem_cache_put(struct dnx_gem_cache *cache, size_t size,
+		void *vaddr, dma_addr_t paddr)
+{
+	size_t max = (size_t)READ_ONCE(dnx_bo_cache_kb) * SZ_1K;
+	struct dnx_gem_cache_entry *entry, *old, *tmp;
+	LIST_HEAD(evicted);
+
+	if(size > max || !READ_ONCE(cache->enabled))
+		return false;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if(!entry)
+		return false;
+
+	entry->vaddr = vaddr;
+	entry->paddr = paddr;
+	entry->size = size;
+
+	mutex_lock(&cache->lock);
+	if(!cache->enabled) {
+		mutex_unlock(&cache->lock);
+		kfree(entry);
+		return false;
+	}
+
+	list_for_each_entry_safe(old, tmp, &cache->lru, lru_node) {
+		if(cache->size + size <= max)
+			break;
+		cache_unlink(cache, old);
+		list_add_tail(&old->lru_node, &evicted);
+		cache->evictions++;
+	}
+
+	list_add(&entry->bucket_node, &cache->buckets[cache_bucket(size)]);
+	list_add_tail(&entry->lru_node, &cache->lru);
+	cache->size += size;
+	cache->count++;
+	mutex_unlock(&cache->lock);
+
+	cache_free_list(cache, &evicted);
+
+	return true;
+}
+
+
+static unsigned long cache_shrink_count(struct shrinker *shrinker,
+		struct shrink_control *sc)
+{
+	struct dnx_gem_cache *cache =
+		container_of(shrinker, struct dnx_gem_cache, shrinker);
+
+	return READ_ONCE(cache->count);
+}
+
+
+static unsigned long cache_shrink_scan(struct shrinker *shrinker,
+		struct shrink_control *sc)
+{
+	struct dnx_gem_cache *cache =
+		container_of(shrinker, struct dnx_gem_cache, shrinker);
+
+	return dnx_gem_cache_evict(cache, sc->nr_to_scan);
+}
+
+
+int dnx_gem_cache_init(struct dnx_gem_cache *cache, struct device *dev)
+{
+	unsigned int i;
+
+	cache->dev = dev;
+	mutex_init(&cache->lock);
+	for(i = 0; i < DNX_GEM_CACHE_BUCKETS; i++)
+		INIT_LIST_HEAD(&cache->buckets[i]);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->size = 0;
+	cache->count = 0;
+	cache->enabled = true;
+
+	cache->shrinker.count_objects = cache_shrink_count;
+	cache->shrinker.scan_objects = cache_shrink_scan;
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+
+	return register_shrinker(&cache->shrinker);
+}
+
+
+void dnx_gem_cache_fini(struct dnx_gem_cache *cache)
+{
+	unregister_shrinker(&cache->shrinker);
+
+	mutex_lock(&cache->lock);
+	cache->enabled = false;
+	mutex_unlock(&cache->lock);
+
+	dnx_gem_cache_evict(cache, ULONG_MAX);
+}
+
+
+void dnx_gem_cache_show(struct dnx_gem_cache *cache, struct seq_file *m)
+{
+	struct dnx_gem_cache_entry *entry;
+	unsigned int counts[DNX_GEM_CACHE_BUCKETS] = { 0 };
+	unsigned int i;
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry(entry, &cache->lru, lru_node)
+		counts[cache_bucket(entry->size)]++;
+
+	seq_printf(m, "cached: %u bos, %zu KiB (max %u KiB)\n", cache->count,
+			cache->size / SZ_1K, READ_ONCE(dnx_bo_cache_kb));
+	seq_printf(m, "hits: %lu\nmisses: %lu\nevictions: %lu\n",
+			cache->hits, cache->misses, cache->evictions);
+	mutex_unlock(&cache->lock);
+
+	for(i = 0; i < DNX_GEM_CACHE_BUCKETS; i++) {
+		if(counts[i])
+			seq_printf(m, "%8lu KiB: %u\n",
+					(PAGE_SIZE << i) / SZ_1K, counts[i]);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef _DNX_GEM_CACHE_H_
+#define _DNX_GEM_CACHE_H_
+
+
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/types.h>
+
+
+struct device;
+struct seq_file;
+
+
+/* bucket n holds buffers of [2^n, 2^(n+1)) pages, the last one all larger */
+#define DNX_GEM_CACHE_BUCKETS (12)
+#define DNX_GEM_CACHE_KB (8192) /* default max. size of cached buffers */
+
+/* CMA backing of freed bos, handed out again by GEM_NEW */
+struct dnx_gem_cache {
+	struct device *dev;
+	struct mutex lock; /* protects everything below */
+	struct list_head buckets[DNX_GEM_CACHE_BUCKETS]; /* newest first */
+	struct list_head lru; /* oldest first */
+	size_t size;  /* bytes cached */
+	unsigned int count;
+	bool enabled; /* cleared on fini, late frees bypass the cache */
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+
+	struct shrinker shrinker;
+};
+
+
+int dnx_gem_cache_init(struct dnx_gem_cache *cache, struct device *dev);
+void dnx_gem_cache_fini(struct dnx_gem_cache *cache);
+bool dnx_gem_cache_get(struct dnx_gem_cache *cache, size_t size,
+		void **vaddr, dma_addr_t *paddr);
+bool dnx_gem_cache_put(struct dnx_gem_cache *cache, size_t size,
+		void *vaddr, dma_addr_t paddr);
+unsigned long dnx_gem_cache_evict(struct dnx_gem_cache *cache,
+		unsigned long nr);
+void dnx_gem_cache_show(struct dnx_gem_cache *cache, struct seq_file *m);
+
+
+#endif /* _DNX_GEM_CACHE_H_ */
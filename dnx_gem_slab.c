@@ -0,0 +1,195 @@
+#include "dnx_gem.h"
+
+#include <linux/bitmap.h>
+#include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "dnx_drv.h"
+#include "dnx_gpu.h"
+
+
+#define DNX_SLAB_BLOCKS (DNX_SLAB_SIZE / DNX_SLAB_ALIGN)
+
+/* A chunk of CMA memory small bos of one client are carved from. Slabs are
+ * never shared between clients, as mappings of a small bo expose the whole
+ * pages it touches. */
+struct dnx_gem_slab {
+	struct list_head node; /* owner's slabs, protected by its slab_lock */
+	struct dnx_file_priv *owner;
+	void *vaddr;
+	dma_addr_t paddr;
+	unsigned int used; /* allocated blocks */
+	DECLARE_BITMAP(map, DNX_SLAB_BLOCKS);
+};
+
+
+static struct dnx_gem_slab *slab_new(struct dnx_device *dnx,
+		struct dnx_file_priv *priv)
+{
+	struct dnx_gem_slab *slab;
+
+	slab = kzalloc(sizeof(*slab), GFP_KERNEL);
+	if(!slab)
+		return NULL;
+
+	if(!dnx_gem_cache_get(&dnx->bo_cache, DNX_SLAB_SIZE, &slab->vaddr,
+			&slab->paddr)) {
+		slab->vaddr = dma_alloc_wc(dnx->dev, DNX_SLAB_SIZE,
+				&slab->paddr, GFP_KERNEL);
+		if(!slab->vaddr) {
+			kfree(slab);
+			return NULL;
+		}
+	}
+
+	slab->owner = priv;
+	priv->nr_slabs++;
+	list_add(&slab->node, &priv->slabs);
+
+	return slab;
+}
+
+
+static void slab_free(struct dnx_device *dnx, struct dnx_gem_slab *slab)
+{
+	struct dnx_file_priv *priv = slab->owner;
+
+	list_del(&slab->node);
+	priv->nr_slabs--;
+
+	if(!dnx_gem_cache_put(&dnx->bo_cache, DNX_SLAB_SIZE, slab->vaddr,
+			slab->paddr))
+		dma_free_wc(dnx->dev, DNX_SLAB_SIZE, slab->vaddr, slab->paddr);
+
+	kfree(slab);
+}
+
+
+/* Reserves nr blocks in one of the client's slabs, a new slab is added if
+ * none has room. Returns the slab and the first block in *block. */
+static struct dnx_gem_slab *slab_alloc(struct dnx_device *dnx,
+		struct dnx_file_priv *priv, unsigned int nr, unsigned int *block)
+{
+	struct dnx_gem_slab *slab;
+	unsigned long start;
+
+	mutex_lock(&priv->slab_lock);
+
+	list_for_each_entry(slab, &priv->slabs, node) {
+		if(slab->used + nr > DNX_SLAB_BLOCKS)
+			continue;
+
+		start = bitmap_find_next_zero_area(slab->map, DNX_SLAB_BLOCKS,
+				0, nr, 0);
+		if(start < DNX_SLAB_BLOCKS)
+			goto found;
+	}
+
+	slab = slab_new(dnx, priv);
+	if(!slab) {
+		mutex_unlock(&priv->slab_lock);
+		return NULL;
+	}
+	start = 0;
+
+found:
+	bitmap_set(slab->map, start, nr);
+	slab->used += nr;
+	mutex_unlock(&priv->slab_lock);
+
+	*block = start;
+
+	return slab;
+}
+
+
+/* Creates a bo of at most DNX_SLAB_MAX bytes in one of priv's slabs. The
+ * gem object spans the pages the bo touches, as mappings are page based. */
+struct drm_gem_cma_object *dnx_gem_slab_new(struct drm_device *dev,
+	size_t size, struct dnx_file_priv *priv)
+{
+	struct dnx_device *dnx = dev->dev_private;
+	unsigned int nr = DIV_ROUND_UP(size, DNX_SLAB_ALIGN);
+	struct dnx_gem_slab *slab;
+	struct drm_gem_object *obj;
+	struct dnx_gem_object *bo;
+	unsigned int block;
+	size_t offset, span;
+	int ret;
+
+	slab = slab_alloc(dnx, priv, nr, &block);
+	if(!slab)
+		return ERR_PTR(-ENOMEM);
+
+	offset = block * DNX_SLAB_ALIGN;
+	span = PAGE_ALIGN(offset_in_page(offset) + nr * DNX_SLAB_ALIGN);
+
+	obj = dnx_gem_create_object(dev, span);
+	if(!obj) {
+		ret = -ENOMEM;
+		goto error_block;
+	}
+	drm_gem_private_object_init(dev, obj, span);
+
+	bo = to_dnx_bo(obj);
+	bo->slab = slab;
+	bo->size = nr * DNX_SLAB_ALIGN;
+	bo->base.vaddr = slab->vaddr + offset;
+	bo->base.paddr = slab->paddr + offset;
+
+	/* blocks are reused within the slab, GEM_NEW returns zeroed bos */
+	memset(bo->base.vaddr, 0, bo->size);
+
+	ret = drm_gem_create_mmap_offset(obj);
+	if(ret) {
+		/* releases the block with the object */
+		drm_gem_object_unreference_unlocked(obj);
+		return ERR_PTR(ret);
+	}
+
+	return &bo->base;
+
+error_block:
+	mutex_lock(&priv->slab_lock);
+	bitmap_clear(slab->map, block, nr);
+	if(!(slab->used -= nr))
+		slab_free(dnx, slab);
+	mutex_unlock(&priv->slab_lock);
+
+	return ERR_PTR(ret);
+}
+
+
+/* Returns the blocks of a freed bo to its slab, empty slabs are freed. */
+void dnx_gem_slab_free(struct dnx_gem_object *bo)
+{
+	struct dnx_device *dnx = bo->base.base.dev->dev_private;
+	struct dnx_gem_slab *slab = bo->slab;
+	struct dnx_file_priv *priv = slab->owner;
+	unsigned int nr = bo->size / DNX_SLAB_ALIGN;
+
+	mutex_lock(&priv->slab_lock);
+	bitmap_clear(slab->map, (bo->base.paddr - slab->paddr) / DNX_SLAB_ALIGN,
+			nr);
+	if(!(slab->used -= nr))
+		slab_free(dnx, slab);
+	mutex_unlock(&priv->slab_lock);
+
+	bo->slab = NULL;
+	bo->base.vaddr = NULL;
+}
+
+
+/* Maps the pages of the slab the bo touches, it starts at the in-page
+ * offset of its paddr. */
+int dnx_gem_slab_mmap(struct dnx_gem_object *bo, struct vm_area_struct *vma)
+{
+	struct dnx_gem_slab *slab = bo->slab;
+
+	vma->vm_pgoff = (bo->base.paddr - slab->paddr) >> PAGE_SHIFT;
+
+	return dma_mmap_wc(bo->base.base.dev->dev, vma, slab->vaddr,
+			slab->paddr, DNX_SLAB_SIZE);
+}
@@ -1,90 +1,907 @@
 #include "dnx_gem.h"
 
+#include <linux/file.h>
+#include <linux/reservation.h>
+#include <linux/sync_file.h>
 #include <drm/drm_gem.h>
 #include <drm/drm_gem_cma_helper.h>
 
 #include "dnx_gpu.h"
+#include "dnx_trace.h"
 
 
-int dnx_ioctl_gem_submit(struct drm_device *dev, void *data,
-		struct drm_file *file)
+/* bo entries copied on the stack instead of allocating them */
+#define DNX_SUBMIT_STACK_BOS (16)
+
+
+/* Drops the reservation locks taken for cmdbuf's objects. */
+void dnx_submit_unlock_objects(struct dnx_cmdbuf *cmdbuf)
+{
+	unsigned int i;
+
+	for(i = 0; i < cmdbuf->nr_bos; i++) {
+		struct dnx_cmdbuf_bo *bo = &cmdbuf->bos[i];
+
+		if(bo->flags & DNX_CMDBUF_BO_LOCKED) {
+			ww_mutex_unlock(&to_dnx_bo(&bo->obj->base)->resv->lock);
+			bo->flags &= ~DNX_CMDBUF_BO_LOCKED;
+		}
+	}
+}
+
+
+static void submit_unlock_all(struct dnx_cmdbuf **cmdbufs, unsigned int nr)
+{
+	unsigned int i;
+
+	for(i = 0; i < nr; i++)
+		dnx_submit_unlock_objects(cmdbufs[i]);
+}
+
+
+/* Locks the reservations of all objects of the nr cmdbufs in one acquire
+ * context, so a batch sharing bos between its cmdbufs can't deadlock. */
+static int submit_lock_objects(struct dnx_cmdbuf **cmdbufs, unsigned int nr,
+		struct ww_acquire_ctx *ticket)
+{
+	struct dnx_cmdbuf_bo *contended = NULL;
+	unsigned int c, i;
+	int ret = 0;
+
+retry:
+	for(c = 0; c < nr; c++) {
+		for(i = 0; i < cmdbufs[c]->nr_bos; i++) {
+			struct dnx_cmdbuf_bo *bo = &cmdbufs[c]->bos[i];
+			struct reservation_object *resv =
+				to_dnx_bo(&bo->obj->base)->resv;
+
+			if(bo->flags & DNX_CMDBUF_BO_LOCKED)
+				continue;
+
+			ret = ww_mutex_lock_interruptible(&resv->lock, ticket);
+			/* the same bo may be listed more than once */
+			if(ret == -EALREADY)
+				continue;
+			if(ret) {
+				contended = bo;
+				goto fail;
+			}
+			bo->flags |= DNX_CMDBUF_BO_LOCKED;
+		}
+	}
+
+	ww_acquire_done(ticket);
+
+	return 0;
+
+fail:
+	submit_unlock_all(cmdbufs, nr);
+
+	if(ret == -EDEADLK) {
+		/* we lost out in a seqno race, lock and retry.. */
+		ret = ww_mutex_lock_slow_interruptible(
+				&to_dnx_bo(&contended->obj->base)->resv->lock,
+				ticket);
+		if(!ret) {
+			contended->flags |= DNX_CMDBUF_BO_LOCKED;
+			goto retry;
+		}
+	}
+
+	return ret;
+}
+
+
+/* Implicit synchronisation with other devices: GPU reads wait for foreign
+ * writers, GPU writes for all foreign users. The fences become deps of the
+ * cmdbuf, which waits for them in the scheduler queue. The client's own
+ * fences of the same priority are ordered by the scheduler already.
+ * Reservations must be locked. */
+static int submit_fence_sync(struct dnx_cmdbuf *cmdbuf)
+{
+	u64 context = cmdbuf->priv->fence_context + cmdbuf->prio;
+	unsigned int i, j;
+	int ret = 0;
+
+	for(i = 0; i < cmdbuf->nr_bos; i++) {
+		struct dnx_cmdbuf_bo *bo = &cmdbuf->bos[i];
+		struct reservation_object *resv = to_dnx_bo(&bo->obj->base)->resv;
+		struct fence *excl, **shared = NULL;
+		unsigned int nr_shared = 0;
+
+		if(bo->flags & DNX_SUBMIT_BO_WRITE) {
+			ret = reservation_object_get_fences_rcu(resv, &excl,
+					&nr_shared, &shared);
+			if(ret)
+				return ret;
+		}
+		else {
+			excl = reservation_object_get_excl(resv);
+			if(excl)
+				fence_get(excl);
+
+			/* a read only bo takes a shared fence on submit */
+			ret = reservation_object_reserve_shared(resv);
+			if(ret) {
+				fence_put(excl);
+				return ret;
+			}
+		}
+
+		for(j = 0; j < nr_shared; j++) {
+			if(!ret && shared[j]->context != context)
+				ret = dnx_gpu_cmdbuf_add_dep(cmdbuf, shared[j]);
+			else
+				fence_put(shared[j]);
+		}
+		kfree(shared);
+
+		if(excl) {
+			if(!ret && excl->context != context)
+				ret = dnx_gpu_cmdbuf_add_dep(cmdbuf, excl);
+			else
+				fence_put(excl);
+		}
+
+		if(ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+/* Publishes the buffer's fence in the reservations of its objects. Called by
+ * dnx_gpu_submit_batch() while the buffer can't be retired yet, the
+ * reservations are unlocked afterwards with dnx_submit_unlock_objects(). */
+void dnx_submit_attach_fence(struct dnx_cmdbuf *cmdbuf, struct fence *fence)
+{
+	unsigned int i;
+
+	for(i = 0; i < cmdbuf->nr_bos; i++) {
+		struct dnx_cmdbuf_bo *bo = &cmdbuf->bos[i];
+		struct reservation_object *resv = to_dnx_bo(&bo->obj->base)->resv;
+
+		/* duplicate entries were locked through their first entry */
+		if(bo->flags & DNX_SUBMIT_BO_WRITE)
+			reservation_object_add_excl_fence(resv, fence);
+		else
+			reservation_object_add_shared_fence(resv, fence);
+	}
+}
+
+
+/* Expands an array of nr plain handles at the start of bos in place. */
+static void expand_handles(struct drm_dnx_submit_bo *bos, u32 nr)
+{
+	u32 *handles = (u32 *)bos;
+	int i;
+
+	/* back to front, bos[i] never overlaps handles[0..i-1] */
+	for(i = nr - 1; i >= 0; i--) {
+		u32 handle = handles[i];
+
+		bos[i].handle = handle;
+		bos[i].flags = DNX_SUBMIT_BO_READ | DNX_SUBMIT_BO_WRITE;
+	}
+}
+
+
+/* Creates the cmdbuf for one stream and resolves its objects. */
+static int submit_prepare(struct drm_device *dev, struct drm_file *file,
+		const struct drm_dnx_submit_stream *desc, u32 flags,
+		struct dnx_cmdbuf **out)
 {
 	struct dnx_device *dnx = dev->dev_private;
-	struct drm_dnx_stream_submit *args = data;
-	u32 *handles;
-	struct drm_gem_cma_object **bos = NULL;
+	struct drm_dnx_submit_bo stack_bos[DNX_SUBMIT_STACK_BOS];
+	struct drm_dnx_submit_bo *bos = stack_bos;
 	struct dnx_cmdbuf *cmdbuf;
+	struct dnx_cmdbuf_bo *jmp_bo = NULL;
 	struct drm_gem_cma_object *last_page;
 	dma_addr_t stream_addr;
 	void* stream_jmpaddr;
+	u64 jump = desc->jump;
+	u32 nr_bos = desc->nr_bos;
 	int ret, i;
 
 	dev_dbg(dev->dev, "Submitting stream:\n");
-	dev_dbg(dev->dev, " paddr=0x%08llx\n", args->stream);
-	dev_dbg(dev->dev, " pjmpaddr=0x%08llx\n", args->jump);
-	dev_dbg(dev->dev, " nr_bo=%d\n", args->nr_bos);
-	dev_dbg(dev->dev, " bos=0x%08llx\n", args->bos);
+	dev_dbg(dev->dev, " paddr=0x%08llx\n", desc->stream);
+	dev_dbg(dev->dev, " pjmpaddr=0x%08llx\n", jump);
+	dev_dbg(dev->dev, " nr_bo=%d\n", nr_bos);
+	dev_dbg(dev->dev, " bos=0x%08llx\n", desc->bos);
 
-	if(args->nr_bos == 0)
+	trace_dnx_submit(dnx, desc->stream, nr_bos);
+
+	if(nr_bos == 0)
 		return -EINVAL;
 
-	handles = drm_malloc_ab(args->nr_bos, sizeof(*handles));
-	bos = drm_malloc_ab(args->nr_bos, sizeof(*bos));
-	cmdbuf = dnx_gpu_cmdbuf_new(dnx, args->nr_bos);
-	if(!handles || !bos || !cmdbuf) {
+	/* small bo lists are copied to the stack */
+	if(nr_bos > ARRAY_SIZE(stack_bos))
+		bos = drm_malloc_ab(nr_bos, sizeof(*bos));
+	cmdbuf = dnx_gpu_cmdbuf_new(dnx, nr_bos);
+	if(!bos || !cmdbuf) {
 		ret = -ENOMEM;
 		goto error_handles;
 	}
 
-	ret = copy_from_user(handles, u64_to_user_ptr(args->bos),
-			args->nr_bos * sizeof(*handles));
+	cmdbuf->priv = dnx_file_priv_get(file->driver_priv);
+
+	if(flags & DNX_SUBMIT_BO_FLAGS) {
+		ret = copy_from_user(bos, u64_to_user_ptr(desc->bos),
+				nr_bos * sizeof(*bos));
+	}
+	else {
+		ret = copy_from_user(bos, u64_to_user_ptr(desc->bos),
+				nr_bos * sizeof(u32));
+		expand_handles(bos, nr_bos);
+	}
 	if(ret) {
 		ret = -EFAULT;
 		goto error_handles;
 	}
 
-	ret = dnx_gpu_cmdbuf_lookup_objects(cmdbuf, file, handles, args->nr_bos);
+	ret = dnx_gpu_cmdbuf_lookup_objects(cmdbuf, file, bos, nr_bos);
 	if(ret)
 		goto error_handles;
 
+	/* the GPU does not snoop, CPU writes to cached bos must reach memory */
+	for(i = 0; i < cmdbuf->nr_bos; ++i)
+		dnx_gem_sync_dirty(to_dnx_bo(&cmdbuf->bos[i].obj->base));
+
 	/* todo: remove when offset is computed in userspace */
-	stream_addr = args->stream;
+	stream_addr = desc->stream;
+
+	dnx_gpu_cmdbuf_track(cmdbuf);
 
 	/* Check if address of last jump lies within stream */
-	for(i = 0; i < cmdbuf->nr_bos; ++i) {
-		if((args->jump > cmdbuf->bos[i]->paddr) &&
-		   (args->jump < (cmdbuf->bos[i]->paddr + cmdbuf->bos[i]->base.size))) {
-			break;
-		}
+	if(jump == (dma_addr_t)jump) {
+		spin_lock_irq(&dnx->bo_tree_lock);
+		jmp_bo = dnx_gpu_lookup_bo(dnx, jump, cmdbuf);
+		spin_unlock_irq(&dnx->bo_tree_lock);
 	}
-	if(i == cmdbuf->nr_bos) {
+	if(!jmp_bo || jump == jmp_bo->obj->paddr) {
 		dev_err(dev->dev,
 			"Error in stream data. Given jump address 0x%llx is not"
 			" within stream.\n",
-			args->jump);
+			jump);
 		ret = -EFAULT;
 		goto error_handles;
 	}
 
-	last_page = cmdbuf->bos[i];
-	stream_jmpaddr = (void*) (last_page->vaddr + (args->jump - last_page->paddr));
+	last_page = jmp_bo->obj;
+	stream_jmpaddr = (void*) (last_page->vaddr + (jump - last_page->paddr));
 	cmdbuf->paddr = stream_addr;
 	cmdbuf->vjmpaddr = stream_jmpaddr;
+	cmdbuf->jmp_bo = to_dnx_bo(&last_page->base);
 	dev_dbg(dev->dev, " pstreamaddr=0x%08x vjmpaddr=0x%p\n", stream_addr, stream_jmpaddr);
 
-	ret = dnx_gpu_submit(dev->dev_private, cmdbuf);
-	args->fence = cmdbuf->fence;
-	if(ret == 0)
-		cmdbuf = NULL;
+	*out = cmdbuf;
+	cmdbuf = NULL;
 
 error_handles:
 	/* if we still own the cmdbuf, we came here due to an error */
 	if(cmdbuf)
 		dnx_gpu_cmdbuf_free(cmdbuf);
-	if(handles)
-		drm_free_large(handles);
-	if(bos)
+	if(bos && bos != stack_bos)
 		drm_free_large(bos);
 
 	return ret;
 }
+
+
+/* Synchronises and queues the nr cmdbufs in one go at priority prio. Takes
+ * over the cmdbufs in any case, a reference to each cmdbuf's fence is
+ * returned in fences. With sync_file, one is created for the last fence
+ * before the cmdbufs are queued. */
+static int dnx_submit(struct drm_device *dev, struct drm_file *file,
+		struct dnx_cmdbuf **cmdbufs, unsigned int nr, unsigned int prio,
+		struct fence **fences, struct sync_file **sync_file)
+{
+	struct dnx_device *dnx = dev->dev_private;
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct ww_acquire_ctx ticket;
+	unsigned int i;
+	int ret;
+
+	for(;;) {
+		/* not with the bos locked, that would block CPU_PREP and other
+		 * submitters using them */
+		ret = dnx_gpu_sched_wait_space(dnx, prio, nr);
+		if(ret)
+			goto error_free;
+
+		ww_acquire_init(&ticket, &reservation_ww_class);
+
+		ret = submit_lock_objects(cmdbufs, nr, &ticket);
+		if(ret)
+			goto error_ticket;
+
+		for(i = 0; i < nr; i++) {
+			cmdbufs[i]->prio = prio;
+			ret = submit_fence_sync(cmdbufs[i]);
+			if(ret)
+				goto error_unlock;
+		}
+
+		ret = dnx_gpu_submit_batch(dnx, cmdbufs, nr, prio, fences,
+				sync_file);
+		if(ret == 0) {
+			ww_acquire_fini(&ticket);
+			atomic64_add(nr, &priv->jobs);
+			return 0;
+		}
+		if(ret != -ENOSPC)
+			goto error_unlock;
+
+		/* others filled the queue meanwhile, the deps added by
+		 * submit_fence_sync() are merged on the next try */
+		submit_unlock_all(cmdbufs, nr);
+		ww_acquire_fini(&ticket);
+	}
+
+error_unlock:
+	submit_unlock_all(cmdbufs, nr);
+error_ticket:
+	ww_acquire_fini(&ticket);
+error_free:
+	for(i = 0; i < nr; i++)
+		dnx_gpu_cmdbuf_free(cmdbufs[i]);
+
+	return ret;
+}
+
+
+/* Makes cmdbuf wait for a sync_file fd given as in fence, without blocking
+ * the submit. */
+static int submit_add_in_fence(struct dnx_cmdbuf *cmdbuf, int fd,
+		unsigned int prio)
+{
+	struct fence *in_fence;
+
+	in_fence = sync_file_get_fence(fd);
+	if(!in_fence)
+		return -EINVAL;
+
+	/* own fences of the same priority are ordered by the scheduler */
+	if(in_fence->context == cmdbuf->priv->fence_context + prio) {
+		fence_put(in_fence);
+		return 0;
+	}
+
+	return dnx_gpu_cmdbuf_add_dep(cmdbuf, in_fence);
+}
+
+
+/* Installs the sync_file of the out fence in the reserved fd, both were set
+ * up before the job was queued so this can't fail. */
+static void submit_install_out_fence(struct sync_file *sync_file,
+		int *out_fence_fd, __s32 *fence_fd)
+{
+	fd_install(*out_fence_fd, sync_file->file);
+	*fence_fd = *out_fence_fd;
+	*out_fence_fd = -1;
+}
+
+
+/* Completion event of a submit with DNX_SUBMIT_EVENT, freed by the DRM core
+ * once read or with the file. */
+struct dnx_submit_event {
+	struct drm_pending_event base;
+	struct drm_dnx_event_fence event;
+	struct fence_cb cb;
+	struct drm_device *dev;
+};
+
+
+/* Reserves the event before the submit, so only the submit can fail. */
+static int submit_event_new(struct drm_device *dev, struct drm_file *file,
+		u64 data, struct dnx_submit_event **out)
+{
+	struct dnx_submit_event *e;
+	int ret;
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if(!e)
+		return -ENOMEM;
+
+	e->event.base.type = DRM_DNX_EVENT_FENCE;
+	e->event.base.length = sizeof(e->event);
+	e->event.user_data = data;
+	e->dev = dev;
+
+	ret = drm_event_reserve_init(dev, file, &e->base, &e->event.base);
+	if(ret) {
+		kfree(e);
+		return ret;
+	}
+
+	*out = e;
+
+	return 0;
+}
+
+
+/* Called by fence_signal() from the irq thread or the hang recovery, the
+ * timestamp is the one fence_signal() took for the fence. */
+static void submit_event_send(struct fence *fence, struct fence_cb *cb)
+{
+	struct dnx_submit_event *e = container_of(cb, struct dnx_submit_event, cb);
+	struct timespec ts = ktime_to_timespec(fence->timestamp);
+
+	e->event.timestamp.tv_sec = ts.tv_sec;
+	e->event.timestamp.tv_nsec = ts.tv_nsec;
+	e->event.fence = dnx_gpu_fence_id(fence);
+	e->event.error = fence->status < 0 ? fence->status : 0;
+
+	drm_send_event(e->dev, &e->base);
+}
+
+
+/* Hands the event over to fence, sent right away if it signaled already. */
+static void submit_event_queue(struct dnx_submit_event *e,
+		struct fence *fence)
+{
+	if(fence_add_callback(fence, &e->cb, submit_event_send))
+		submit_event_send(fence, &e->cb);
+}
+
+
+/* Waits for a just submitted job. The result is reported to userspace
+ * separately, as a restarted ioctl would submit the job again. */
+static int submit_wait(struct dnx_device *dnx, struct fence *fence,
+		struct drm_dnx_timespec *timeout)
+{
+	int ret;
+
+	ret = dnx_gpu_wait_fence_interruptible(dnx, dnx_gpu_fence_id(fence),
+			&TS(*timeout));
+	if(ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	return ret;
+}
+
+
+int dnx_ioctl_gem_submit(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct drm_dnx_stream_submit *args = data;
+	struct drm_dnx_submit_stream desc = {
+		.stream = args->stream,
+		.jump = args->jump,
+		.bos = args->bos,
+		.nr_bos = args->nr_bos,
+	};
+	struct dnx_cmdbuf *cmdbuf;
+	struct fence *fence;
+	int ret;
+
+	ret = submit_prepare(dev, file, &desc, 0, &cmdbuf);
+	if(ret)
+		return ret;
+
+	ret = dnx_submit(dev, file, &cmdbuf, 1, DNX_SUBMITQUEUE_PRIO_NORMAL,
+			&fence, NULL);
+	if(ret)
+		return ret;
+
+	args->fence = dnx_gpu_fence_id(fence);
+	fence_put(fence);
+
+	return 0;
+}
+
+
+/* Creates a cmdbuf for a run of job from its template, without looking up
+ * the bos or the jump again. */
+static int job_prepare(struct dnx_job *job, struct dnx_cmdbuf **out)
+{
+	struct dnx_cmdbuf *tmpl = job->cmdbuf;
+	struct dnx_cmdbuf *cmdbuf;
+	unsigned int i;
+
+	trace_dnx_submit(tmpl->dnx, tmpl->paddr, tmpl->nr_bos);
+
+	cmdbuf = dnx_gpu_cmdbuf_new(tmpl->dnx, tmpl->nr_bos);
+	if(!cmdbuf)
+		return -ENOMEM;
+
+	memcpy(cmdbuf->bos, tmpl->bos, tmpl->nr_bos * sizeof(cmdbuf->bos[0]));
+	cmdbuf->nr_bos = tmpl->nr_bos;
+	cmdbuf->paddr = tmpl->paddr;
+	cmdbuf->vjmpaddr = tmpl->vjmpaddr;
+	cmdbuf->jmp_bo = tmpl->jmp_bo;
+	cmdbuf->priv = dnx_file_priv_get(tmpl->priv);
+	kref_get(&job->ref);
+	cmdbuf->job = job;
+	dnx_gpu_cmdbuf_track(cmdbuf);
+
+	/* the content of cached bos may have changed since the last run */
+	for(i = 0; i < cmdbuf->nr_bos; ++i)
+		dnx_gem_sync_dirty(to_dnx_bo(&cmdbuf->bos[i].obj->base));
+
+	*out = cmdbuf;
+
+	return 0;
+}
+
+
+/* Submits the stream of args or a run of job if given. */
+static int submit_ext(struct drm_device *dev, struct drm_file *file,
+		struct drm_dnx_stream_submit_ext *args, struct dnx_job *job)
+{
+	struct dnx_device *dnx = dev->dev_private;
+	struct drm_dnx_submit_stream desc = {
+		.stream = args->stream,
+		.jump = args->jump,
+		.bos = args->bos,
+		.nr_bos = args->nr_bos,
+	};
+	struct dnx_submit_event *event = NULL;
+	struct sync_file *sync_file = NULL;
+	struct dnx_cmdbuf *cmdbuf;
+	struct fence *fence;
+	unsigned int prio;
+	int out_fence_fd = -1;
+	int ret;
+
+	if(args->flags & ~DNX_SUBMIT_FLAGS)
+		return -EINVAL;
+
+	ret = dnx_submitqueue_prio(file->driver_priv, args->queue, &prio);
+	if(ret)
+		return ret;
+
+	if(args->flags & DNX_SUBMIT_FENCE_FD_OUT) {
+		out_fence_fd = get_unused_fd_flags(O_CLOEXEC);
+		if(out_fence_fd < 0)
+			return out_fence_fd;
+	}
+
+	if(args->flags & DNX_SUBMIT_EVENT) {
+		ret = submit_event_new(dev, file, args->event_data, &event);
+		if(ret)
+			goto out_fd;
+	}
+
+	if(job)
+		ret = job_prepare(job, &cmdbuf);
+	else
+		ret = submit_prepare(dev, file, &desc, args->flags, &cmdbuf);
+	if(ret)
+		goto out_event;
+
+	if(args->flags & DNX_SUBMIT_FENCE_FD_IN) {
+		ret = submit_add_in_fence(cmdbuf, args->fence_fd, prio);
+		if(ret) {
+			dnx_gpu_cmdbuf_free(cmdbuf);
+			goto out_event;
+		}
+	}
+
+	/* the previous run returns through the jump patched into the stream
+	 * when this run is linked, so it has to complete first */
+	if(job && job->last) {
+		ret = dnx_gpu_cmdbuf_add_dep(cmdbuf, fence_get(job->last));
+		if(ret) {
+			dnx_gpu_cmdbuf_free(cmdbuf);
+			goto out_event;
+		}
+	}
+
+	ret = dnx_submit(dev, file, &cmdbuf, 1, prio, &fence,
+			out_fence_fd >= 0 ? &sync_file : NULL);
+	if(ret)
+		goto out_event;
+
+	args->fence = dnx_gpu_fence_id(fence);
+
+	if(event)
+		submit_event_queue(event, fence);
+	event = NULL;
+
+	if(job) {
+		if(job->last)
+			fence_put(job->last);
+		job->last = fence_get(fence);
+	}
+
+	if(sync_file)
+		submit_install_out_fence(sync_file, &out_fence_fd,
+				&args->fence_fd);
+
+	if(args->flags & DNX_SUBMIT_WAIT)
+		args->wait_result = submit_wait(dnx, fence, &args->timeout);
+
+	fence_put(fence);
+
+out_event:
+	if(event)
+		drm_event_cancel_free(dev, &event->base);
+out_fd:
+	if(out_fence_fd >= 0)
+		put_unused_fd(out_fence_fd);
+
+	return ret;
+}
+
+
+int dnx_ioctl_gem_submit_ext(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	return submit_ext(dev, file, data, NULL);
+}
+
+
+/* Submits several streams with a single ring update. The flags apply to
+ * every stream, the in fence is waited for once before the batch and the out
+ * fence is the one of the last stream, which completes after all others. */
+int dnx_ioctl_gem_submit_batch(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct dnx_device *dnx = dev->dev_private;
+	struct drm_dnx_stream_submit_batch *args = data;
+	struct drm_dnx_submit_stream *descs;
+	struct dnx_submit_event *event = NULL;
+	struct sync_file *sync_file = NULL;
+	struct dnx_cmdbuf **cmdbufs;
+	struct fence **fences;
+	unsigned int i, prio, nr = args->nr_streams;
+	int out_fence_fd = -1;
+	int ret;
+
+	if(args->flags & ~DNX_SUBMIT_FLAGS)
+		return -EINVAL;
+	if(nr == 0 || nr > DNX_SUBMIT_MAX_STREAMS)
+		return -EINVAL;
+
+	ret = dnx_submitqueue_prio(file->driver_priv, args->queue, &prio);
+	if(ret)
+		return ret;
+
+	/* descriptors, cmdbufs and fences share one allocation */
+	descs = kmalloc(nr * (sizeof(*descs) + sizeof(*cmdbufs) +
+			sizeof(*fences)), GFP_KERNEL);
+	if(!descs)
+		return -ENOMEM;
+	cmdbufs = (struct dnx_cmdbuf **)(descs + nr);
+	fences = (struct fence **)(cmdbufs + nr);
+
+	if(copy_from_user(descs, u64_to_user_ptr(args->streams),
+			nr * sizeof(*descs))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	if(args->flags & DNX_SUBMIT_FENCE_FD_OUT) {
+		out_fence_fd = get_unused_fd_flags(O_CLOEXEC);
+		if(out_fence_fd < 0) {
+			ret = out_fence_fd;
+			goto out_free;
+		}
+	}
+
+	if(args->flags & DNX_SUBMIT_EVENT) {
+		ret = submit_event_new(dev, file, args->event_data, &event);
+		if(ret)
+			goto out_fd;
+	}
+
+	for(i = 0; i < nr; i++) {
+		ret = submit_prepare(dev, file, &descs[i], args->flags,
+				&cmdbufs[i]);
+		if(ret) {
+			while(i--)
+				dnx_gpu_cmdbuf_free(cmdbufs[i]);
+			goto out_event;
+		}
+	}
+
+	/* the other streams are queued behind the first one */
+	if(args->flags & DNX_SUBMIT_FENCE_FD_IN) {
+		ret = submit_add_in_fence(cmdbufs[0], args->fence_fd, prio);
+		if(ret) {
+			for(i = 0; i < nr; i++)
+				dnx_gpu_cmdbuf_free(cmdbufs[i]);
+			goto out_event;
+		}
+	}
+
+	/* the fences are reported in the descriptors once the streams are
+	 * queued, fault on them now rather than after that */
+	if(copy_to_user(u64_to_user_ptr(args->streams), descs,
+			nr * sizeof(*descs))) {
+		for(i = 0; i < nr; i++)
+			dnx_gpu_cmdbuf_free(cmdbufs[i]);
+		ret = -EFAULT;
+		goto out_event;
+	}
+
+	ret = dnx_submit(dev, file, cmdbufs, nr, prio, fences,
+			out_fence_fd >= 0 ? &sync_file : NULL);
+	if(ret)
+		goto out_event;
+
+	for(i = 0; i < nr; i++)
+		descs[i].fence = dnx_gpu_fence_id(fences[i]);
+	args->fence = dnx_gpu_fence_id(fences[nr - 1]);
+
+	if(event)
+		submit_event_queue(event, fences[nr - 1]);
+	event = NULL;
+
+	/* the streams are queued, the submit succeeded even if userspace
+	 * unmapped the descriptors meanwhile, args->fence covers the batch */
+	if(copy_to_user(u64_to_user_ptr(args->streams), descs,
+			nr * sizeof(*descs)))
+		dev_dbg(dev->dev, "stream fences not reported\n");
+
+	if(sync_file)
+		submit_install_out_fence(sync_file, &out_fence_fd,
+				&args->fence_fd);
+
+	if(args->flags & DNX_SUBMIT_WAIT)
+		args->wait_result = submit_wait(dnx, fences[nr - 1],
+				&args->timeout);
+
+	for(i = 0; i < nr; i++)
+		fence_put(fences[i]);
+
+out_event:
+	if(event)
+		drm_event_cancel_free(dev, &event->base);
+out_fd:
+	if(out_fence_fd >= 0)
+		put_unused_fd(out_fence_fd);
+out_free:
+	kfree(descs);
+
+	return ret;
+}
+
+
+static void dnx_job_release(struct kref *ref)
+{
+	struct dnx_job *job = container_of(ref, struct dnx_job, ref);
+
+	if(job->last)
+		fence_put(job->last);
+	dnx_gpu_cmdbuf_free(job->cmdbuf);
+	kfree(job);
+}
+
+
+void dnx_job_put(struct dnx_job *job)
+{
+	kref_put(&job->ref, dnx_job_release);
+}
+
+
+int dnx_ioctl_job_new(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct drm_dnx_job *args = data;
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct drm_dnx_submit_stream desc = {
+		.stream = args->stream,
+		.jump = args->jump,
+		.bos = args->bos,
+		.nr_bos = args->nr_bos,
+	};
+	struct dnx_job *job;
+	int ret;
+
+	if(args->flags & ~DNX_SUBMIT_BO_FLAGS)
+		return -EINVAL;
+
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if(!job)
+		return -ENOMEM;
+	kref_init(&job->ref);
+	mutex_init(&job->lock);
+
+	ret = submit_prepare(dev, file, &desc, args->flags, &job->cmdbuf);
+	if(ret) {
+		kfree(job);
+		return ret;
+	}
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&priv->job_lock);
+	ret = idr_alloc(&priv->job_idr, job, 1, 0, GFP_NOWAIT);
+	if(ret > 0)
+		job->id = ret;
+	spin_unlock(&priv->job_lock);
+	idr_preload_end();
+
+	if(ret < 0) {
+		dnx_job_put(job);
+		return ret;
+	}
+
+	args->id = job->id;
+
+	return 0;
+}
+
+
+/* Runs still queued or executing keep the job alive. */
+int dnx_ioctl_job_close(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct dnx_job *job;
+	u32 *id = data;
+
+	spin_lock(&priv->job_lock);
+	job = idr_find(&priv->job_idr, *id);
+	if(job)
+		idr_remove(&priv->job_idr, *id);
+	spin_unlock(&priv->job_lock);
+
+	if(!job)
+		return -ENOENT;
+
+	dnx_job_put(job);
+
+	return 0;
+}
+
+
+int dnx_ioctl_job_submit(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct drm_dnx_job_submit *args = data;
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct drm_dnx_stream_submit_ext ext = {
+		.flags = args->flags,
+		.fence_fd = args->fence_fd,
+		.timeout = args->timeout,
+		.queue = args->queue,
+		.event_data = args->event_data,
+	};
+	struct dnx_job *job;
+	int ret;
+
+	if(args->flags & DNX_SUBMIT_BO_FLAGS)
+		return -EINVAL;
+
+	spin_lock(&priv->job_lock);
+	job = idr_find(&priv->job_idr, args->id);
+	if(job)
+		kref_get(&job->ref);
+	spin_unlock(&priv->job_lock);
+
+	if(!job)
+		return -ENOENT;
+
+	ret = mutex_lock_interruptible(&job->lock);
+	if(ret)
+		goto out_put;
+
+	ret = submit_ext(dev, file, &ext, job);
+
+	mutex_unlock(&job->lock);
+
+	if(ret == 0) {
+		args->fence_fd = ext.fence_fd;
+		args->fence = ext.fence;
+		args->wait_result = ext.wait_result;
+	}
+
+out_put:
+	dnx_job_put(job);
+
+	return ret;
+}
+
+
+void dnx_job_close_all(struct dnx_file_priv *priv)
+{
+	struct dnx_job *job;
+	int id;
+
+	idr_for_each_entry(&priv->job_idr, job, id)
+		dnx_job_put(job);
+	idr_destroy(&priv->job_idr);
+}
@@ -1,9 +1,13 @@
 #include "dnx_gpu.h"
 
 #include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/sync_file.h>
 
 #include "dnx_drv.h"
 #include "dnx_buffer.h"
+#include "dnx_gem.h"
+#include "dnx_trace.h"
 #include "nx_register_address.h"
 #include "nx_types.h"
 
@@ -15,43 +19,278 @@ static void dnx_hw_init(struct dnx_device *dnx)
 }
 
 
-static void retire_worker(struct work_struct *work)
+static struct kmem_cache *cmdbuf_caches[DNX_CMDBUF_CACHES];
+static struct kmem_cache *fence_cache;
+
+static void sched_worker(struct work_struct *work);
+static void hang_worker(struct work_struct *work);
+static void dnx_gpu_hangcheck(unsigned long data);
+
+
+static inline struct dnx_fence *to_dnx_fence(struct fence *fence)
+{
+	return container_of(fence, struct dnx_fence, base);
+}
+
+
+static const char *dnx_fence_get_driver_name(struct fence *fence)
+{
+	return "dnx";
+}
+
+
+static const char *dnx_fence_get_timeline_name(struct fence *fence)
+{
+	struct dnx_fence *f = to_dnx_fence(fence);
+
+	return dev_name(f->dnx->dev);
+}
+
+
+static bool dnx_fence_enable_signaling(struct fence *fence)
+{
+	/* all pending fences are on the fence_list and get signaled by the
+	 * sync IRQ anyway */
+	return true;
+}
+
+
+static bool dnx_fence_signaled(struct fence *fence)
+{
+	struct dnx_fence *f = to_dnx_fence(fence);
+	u32 hw_seqno;
+
+	/* failed before it was linked, see dnx_gpu_submit_batch() */
+	if(test_bit(FENCE_FLAG_SIGNALED_BIT, &fence->flags))
+		return true;
+
+	/* still waiting in the scheduler if not linked */
+	hw_seqno = READ_ONCE(f->hw_seqno);
+	return hw_seqno && fence_completed(f->dnx, hw_seqno);
+}
+
+
+static void dnx_fence_free_rcu(struct rcu_head *rcu)
+{
+	struct dnx_fence *f = container_of(rcu, struct dnx_fence, base.rcu);
+
+	kmem_cache_free(fence_cache, f);
+}
+
+
+static void dnx_fence_release(struct fence *fence)
+{
+	struct dnx_fence *f = to_dnx_fence(fence);
+	unsigned long flags;
+
+	/* the id is cleared under the lock by dnx_gpu_release() */
+	spin_lock_irqsave(&f->dnx->fence_idr_lock, flags);
+	if(f->id)
+		idr_remove(&f->dnx->fence_idr, f->id);
+	spin_unlock_irqrestore(&f->dnx->fence_idr_lock, flags);
+
+	call_rcu(&fence->rcu, dnx_fence_free_rcu);
+}
+
+
+static const struct fence_ops dnx_fence_ops = {
+	.get_driver_name = dnx_fence_get_driver_name,
+	.get_timeline_name = dnx_fence_get_timeline_name,
+	.enable_signaling = dnx_fence_enable_signaling,
+	.signaled = dnx_fence_signaled,
+	.wait = fence_default_wait,
+	.release = dnx_fence_release,
+};
+
+
+/* Feeds the newest completed job into the average job time. Jobs run back to
+ * back, so a job started when it was linked or when the previous sync irq
+ * came in, whichever was later. Called with the fence_lock held. */
+static void dnx_gpu_update_job_time(struct dnx_device *dnx,
+		struct dnx_fence *f, unsigned int nr_completed)
+{
+	ktime_t done = dnx->sync_time;
+	s64 ns;
+
+	if(ktime_after(f->linked, dnx->sync_time_prev)) {
+		ns = ktime_to_ns(ktime_sub(done, f->linked));
+	}
+	else {
+		ns = ktime_to_ns(ktime_sub(done, dnx->sync_time_prev));
+		ns = div_s64(ns, nr_completed);
+	}
+
+	dnx->sync_time_prev = done;
+
+	if(ns < 0)
+		return;
+	ns = min_t(s64, ns, U32_MAX);
+
+	/* moving average with a weight of 1/8 */
+	dnx->job_time_avg += ((u32)ns >> 3) - (dnx->job_time_avg >> 3);
+}
+
+
+/* Signals the fences of all buffers up to dnx->fence_completed. Called from
+ * the sync IRQ thread. */
+void dnx_gpu_signal_fences(struct dnx_device *dnx)
+{
+	struct dnx_fence *f, *tmp, *last = NULL;
+	unsigned int nr_completed = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dnx->fence_lock, flags);
+
+	list_for_each_entry_safe(f, tmp, &dnx->fence_list, node) {
+		if (!fence_completed(dnx, f->hw_seqno))
+			break;
+
+		if(last)
+			fence_put(&last->base);
+		last = f;
+		nr_completed++;
+
+		list_del(&f->node);
+		fence_signal_locked(&f->base);
+		trace_dnx_fence_signal(dnx, f);
+	}
+
+	if(last) {
+		dnx_gpu_update_job_time(dnx, last, nr_completed);
+		fence_put(&last->base);
+	}
+
+	spin_unlock_irqrestore(&dnx->fence_lock, flags);
+}
+
+
+/* Accounts a retired cmdbuf. Called in retiring order, a job started when it
+ * was linked into the ring or when its predecessor completed. */
+static void dnx_gpu_account_retire(struct dnx_device *dnx,
+		struct dnx_cmdbuf *cmdbuf, ktime_t now)
+{
+	struct dnx_stats *stats = &dnx->stats;
+	struct fence *f = cmdbuf->out_fence;
+	ktime_t done, start;
+	s64 exec_ns;
+
+	/* the irq thread may not have signaled the fence yet */
+	done = test_bit(FENCE_FLAG_SIGNALED_BIT, &f->flags) ? f->timestamp : now;
+
+	spin_lock(&stats->lock);
+	start = ktime_after(cmdbuf->queued, stats->last_done) ?
+		cmdbuf->queued : stats->last_done;
+	exec_ns = ktime_after(done, start) ? ktime_to_ns(ktime_sub(done, start)) : 0;
+	dnx_hist_add(&stats->exec, div_s64(exec_ns, NSEC_PER_USEC));
+	dnx_hist_add(&stats->total, ktime_us_delta(now, cmdbuf->submitted));
+	stats->last_done = done;
+	spin_unlock(&stats->lock);
+
+	if(cmdbuf->priv) {
+		atomic64_add(exec_ns, &cmdbuf->priv->busy_ns);
+		/* replace the estimate charged when linking */
+		atomic64_add(exec_ns - cmdbuf->sched_charge,
+				&cmdbuf->priv->vruntime);
+	}
+}
+
+
+static void dnx_gpu_retire(struct dnx_device *dnx)
 {
-	struct dnx_device *dnx = container_of(work, struct dnx_device, retire_work);
 	u32 fence = dnx->fence_completed;
 	struct dnx_cmdbuf *cmdbuf, *tmp;
-	unsigned int i;
+	LIST_HEAD(retired);
+	ktime_t now;
 
-	mutex_lock(&dnx->lock);
+	/* only detach completed buffers here, dropping their bos may free
+	 * memory and must not stall submitters */
+	spin_lock_irq(&dnx->active_lock);
 
 	list_for_each_entry_safe(cmdbuf, tmp, &dnx->active_cmd_list, node) {
 		if (!fence_completed(dnx, cmdbuf->fence))
 			break;
 
-		list_del(&cmdbuf->node);
+		list_move_tail(&cmdbuf->node, &retired);
 		--dnx->active_cmd_count;
 
-		for (i = 0; i < cmdbuf->nr_bos; i++) {
-			struct drm_gem_cma_object *obj = cmdbuf->bos[i];
+		dnx_buffer_consumed(dnx, cmdbuf);
+	}
 
-			/* drop the refcount taken in dnx_ioctl_gem_submit */
-			drm_gem_object_unreference_unlocked(&obj->base);
-		}
+	dnx->fence_retired = fence;
+
+	spin_unlock_irq(&dnx->active_lock);
 
+	now = ktime_get();
+
+	list_for_each_entry_safe(cmdbuf, tmp, &retired, node) {
+		trace_dnx_retire(cmdbuf);
+		dnx_gpu_account_retire(dnx, cmdbuf, now);
 		dnx_gpu_cmdbuf_free(cmdbuf);
 	}
 
-	dnx->fence_retired = fence;
+//	wake_up_all(&gpu->fence_event);
+}
 
-	mutex_unlock(&dnx->lock);
 
-//	wake_up_all(&gpu->fence_event);
+static void retire_worker(struct work_struct *work)
+{
+	struct dnx_device *dnx = container_of(work, struct dnx_device, retire_work);
+
+	dnx_gpu_retire(dnx);
+}
+
+
+/* Slab caches keep the allocator off the submit path. They are shared by
+ * all devices, as fences may outlive their device. */
+int dnx_gpu_cache_init(void)
+{
+	static const unsigned int cache_bos[] = DNX_CMDBUF_CACHE_BOS;
+	unsigned int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(cache_bos) != DNX_CMDBUF_CACHES);
+
+	fence_cache = KMEM_CACHE(dnx_fence, 0);
+	if(!fence_cache)
+		return -ENOMEM;
+
+	for(i = 0; i < DNX_CMDBUF_CACHES; i++) {
+		struct dnx_cmdbuf *buf;
+		char name[24];
+
+		snprintf(name, sizeof(name), "dnx_cmdbuf_%u", cache_bos[i]);
+		cmdbuf_caches[i] = kmem_cache_create(name,
+				size_vstruct(cache_bos[i], sizeof(buf->bos[0]), sizeof(*buf)),
+				0, SLAB_HWCACHE_ALIGN, NULL);
+		if(!cmdbuf_caches[i]) {
+			dnx_gpu_cache_fini();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+
+void dnx_gpu_cache_fini(void)
+{
+	unsigned int i;
+
+	/* wait for dnx_fence_free_rcu() */
+	rcu_barrier();
+
+	for(i = 0; i < DNX_CMDBUF_CACHES; i++) {
+		kmem_cache_destroy(cmdbuf_caches[i]);
+		cmdbuf_caches[i] = NULL;
+	}
+
+	kmem_cache_destroy(fence_cache);
+	fence_cache = NULL;
 }
 
 
 int dnx_gpu_init(struct dnx_device *dnx) 
 {
-	int ret = 0;
+	int i, ret = 0;
 
 	/* Enable all but SDMA irq.
 	   Currently, there are 5 DMA transfers per vertex. That would
@@ -62,7 +301,7 @@ int dnx_gpu_init(struct dnx_device *dnx)
 	dnx_hw_init(dnx);
 
 	/* create ring-buffer */
-	dnx->buffer = dnx_gpu_ringbuf_new(dnx, DNX_RINGBUFFER_SIZE);
+	dnx->buffer = dnx_gpu_ringbuf_new(dnx, dnx->ring_size);
 	if(!dnx->buffer) {
 		dev_err(dnx->dev, "could not create command buffer\n");
 		return -ENOMEM;
@@ -70,11 +309,33 @@ int dnx_gpu_init(struct dnx_device *dnx)
 
 	dnx_buffer_init(dnx);
 
+	dnx_stats_init(&dnx->stats);
+
+	spin_lock_init(&dnx->active_lock);
 	INIT_LIST_HEAD(&dnx->active_cmd_list);
 	dnx->active_cmd_count = 0;
 
+	spin_lock_init(&dnx->bo_tree_lock);
+	dnx->bo_tree = RB_ROOT;
+
+	for(i = 0; i < DNX_SCHED_PRIOS; i++)
+		INIT_LIST_HEAD(&dnx->sched_queue[i]);
+	init_waitqueue_head(&dnx->sched_waitq);
+	INIT_WORK(&dnx->sched_work, sched_worker);
+	INIT_LIST_HEAD(&dnx->client_list);
+	dnx->sched_window = min(dnx->sched_window,
+			dnx_buffer_max_jobs(dnx->buffer));
+
+	spin_lock_init(&dnx->fence_lock);
+	INIT_LIST_HEAD(&dnx->fence_list);
+	spin_lock_init(&dnx->fence_idr_lock);
+	idr_init(&dnx->fence_idr);
+
 	INIT_WORK(&dnx->retire_work, retire_worker);
 
+	setup_timer(&dnx->hang_timer, dnx_gpu_hangcheck, (unsigned long)dnx);
+	INIT_WORK(&dnx->hang_work, hang_worker);
+
 	dnx->wq = alloc_ordered_workqueue("dnx", 0);
 	if (!dnx->wq) {
 		ret = -ENOMEM;
@@ -90,15 +351,34 @@ out_wq:
 }
 
 
+/* Stops the watchdog and the workers, irqs have to be off already. */
 void dnx_gpu_release(struct dnx_device *dnx)
 {
+	struct dnx_fence *f;
+	int id;
+
+	/* the timer queues the hang worker, which re-arms the timer */
+	WRITE_ONCE(dnx->hang_stopped, true);
+	cancel_work_sync(&dnx->hang_work);
+	del_timer_sync(&dnx->hang_timer);
+	cancel_work_sync(&dnx->hang_work);
+
 	flush_workqueue(dnx->wq);
+	cancel_work_sync(&dnx->sched_work);
 	destroy_workqueue(dnx->wq);
 
 	if(dnx->buffer) {
 		dnx_gpu_ringbuf_free(dnx->buffer);
 		dnx->buffer = NULL;
 	}
+
+	/* the retired cmdbufs dropped their fences, those still held by
+	 * userspace outlive the idr and must not remove their ids anymore */
+	spin_lock_irq(&dnx->fence_idr_lock);
+	idr_for_each_entry(&dnx->fence_idr, f, id)
+		f->id = 0;
+	spin_unlock_irq(&dnx->fence_idr_lock);
+	idr_destroy(&dnx->fence_idr);
 }
 
 
@@ -111,33 +391,47 @@ void dnx_hw_reset(struct dnx_device *dnx)
 }
 
 
-void dnx_gpu_recover_hangup(struct dnx_device *dnx)
-{
-	dnx_hw_reset(dnx);
-
-	dnx->stc_running = false;
-}
-
-
 struct dnx_cmdbuf *dnx_gpu_cmdbuf_new(struct dnx_device *dnx, size_t nr_bo)
 {
+	static const unsigned int cache_bos[] = DNX_CMDBUF_CACHE_BOS;
 	struct dnx_cmdbuf *buf;
-	size_t size = size_vstruct(nr_bo, sizeof(buf->bos[0]), sizeof(*buf));
+	int cache;
 
-	buf = kzalloc(size, GFP_KERNEL);
-	if(!buf)
-		return NULL;
+	for(cache = 0; cache < DNX_CMDBUF_CACHES; cache++) {
+		if(nr_bo <= cache_bos[cache])
+			break;
+	}
+
+	if(cache < DNX_CMDBUF_CACHES) {
+		/* bos are filled by dnx_gpu_cmdbuf_lookup_objects */
+		buf = kmem_cache_alloc(cmdbuf_caches[cache], GFP_KERNEL);
+		if(!buf)
+			return NULL;
+		memset(buf, 0, sizeof(*buf));
+	}
+	else {
+		size_t size = size_vstruct(nr_bo, sizeof(buf->bos[0]), sizeof(*buf));
+
+		if(!size)
+			return NULL;
+		buf = kzalloc(size, GFP_KERNEL);
+		if(!buf)
+			return NULL;
+		cache = -1;
+	}
 
 	buf->dnx = dnx;
+	buf->cache = cache;
+	buf->submitted = ktime_get();
 
-	dev_dbg(dnx->dev, "new cmd buffer %p (bos size=%d)\n", buf, size-sizeof(*buf));
+	dev_dbg(dnx->dev, "new cmd buffer %p (bos=%zu cache=%d)\n", buf, nr_bo, cache);
 
 	return buf;
 }
 
 
 int dnx_gpu_cmdbuf_lookup_objects(struct dnx_cmdbuf *buf,
-	struct drm_file *file, u32 *handles, unsigned nr_bos)
+	struct drm_file *file, struct drm_dnx_submit_bo *bos, unsigned nr_bos)
 {
 	unsigned i;
 	int ret = 0;
@@ -150,10 +444,10 @@ int dnx_gpu_cmdbuf_lookup_objects(struct dnx_cmdbuf *buf,
 		/* normally use drm_gem_object_lookup(), but for bulk lookup
 		 * all under single table_lock just hit object_idr directly:
 		 */
-		obj = idr_find(&file->object_idr, handles[i]);
+		obj = idr_find(&file->object_idr, bos[i].handle);
 		if (!obj) {
 			DRM_ERROR("invalid handle %u at index %u\n",
-					handles[i], i);
+					bos[i].handle, i);
 			ret = -EINVAL;
 			goto out_unlock;
 		}
@@ -164,7 +458,11 @@ int dnx_gpu_cmdbuf_lookup_objects(struct dnx_cmdbuf *buf,
 		 */
 		drm_gem_object_reference(obj);
 
-		buf->bos[i] = to_drm_gem_cma_obj(obj);
+		buf->bos[i].obj = to_drm_gem_cma_obj(obj);
+		buf->bos[i].flags = bos[i].flags &
+				(DNX_SUBMIT_BO_READ | DNX_SUBMIT_BO_WRITE);
+		if (!buf->bos[i].flags)
+			buf->bos[i].flags = DNX_SUBMIT_BO_READ | DNX_SUBMIT_BO_WRITE;
 	}
 
 out_unlock:
@@ -175,10 +473,180 @@ out_unlock:
 }
 
 
+/* Adds the cmdbuf's bos to the device's bo_tree until it is freed, so GPU
+ * addresses map to the bo and cmdbuf in logarithmic time. Overlapping bos
+ * are kept apart by their cmdbuf. */
+void dnx_gpu_cmdbuf_track(struct dnx_cmdbuf *buf)
+{
+	struct dnx_device *dnx = buf->dnx;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&dnx->bo_tree_lock, flags);
+	for(i = 0; i < buf->nr_bos; i++) {
+		struct dnx_cmdbuf_bo *bo = &buf->bos[i];
+		struct drm_gem_cma_object *obj = bo->obj;
+
+		bo->cmdbuf = buf;
+		bo->it.start = obj->paddr;
+		bo->it.last = obj->paddr + to_dnx_bo(&obj->base)->size - 1;
+		interval_tree_insert(&bo->it, &dnx->bo_tree);
+	}
+	buf->tracked = true;
+	spin_unlock_irqrestore(&dnx->bo_tree_lock, flags);
+}
+
+
+static void dnx_gpu_cmdbuf_untrack(struct dnx_cmdbuf *buf)
+{
+	struct dnx_device *dnx = buf->dnx;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&dnx->bo_tree_lock, flags);
+	for(i = 0; i < buf->nr_bos; i++)
+		interval_tree_remove(&buf->bos[i].it, &dnx->bo_tree);
+	buf->tracked = false;
+	spin_unlock_irqrestore(&dnx->bo_tree_lock, flags);
+}
+
+
+/* Finds the bo of cmdbuf that contains addr. Without cmdbuf the bo is
+ * searched in the cmdbufs linked into the ring, to attribute faults.
+ * note: caller must hold the device's bo_tree_lock, the entry stays valid
+ * until it is dropped. */
+struct dnx_cmdbuf_bo *dnx_gpu_lookup_bo(struct dnx_device *dnx,
+	dma_addr_t addr, struct dnx_cmdbuf *cmdbuf)
+{
+	struct interval_tree_node *it;
+
+	for(it = interval_tree_iter_first(&dnx->bo_tree, addr, addr); it;
+	    it = interval_tree_iter_next(it, addr, addr)) {
+		struct dnx_cmdbuf_bo *bo =
+			container_of(it, struct dnx_cmdbuf_bo, it);
+
+		if(cmdbuf ? bo->cmdbuf == cmdbuf : READ_ONCE(bo->cmdbuf->fence))
+			return bo;
+	}
+
+	return NULL;
+}
+
+
 void dnx_gpu_cmdbuf_free(struct dnx_cmdbuf *buf)
 {
+	unsigned int i;
+
 	dev_dbg(buf->dnx->dev, "freeing cmdbuf %p\n", buf);
-	kfree(buf);
+
+	if(buf->tracked)
+		dnx_gpu_cmdbuf_untrack(buf);
+
+	for (i = 0; !buf->job && i < buf->nr_bos; i++) {
+		struct drm_gem_cma_object *obj = buf->bos[i].obj;
+
+		/* drop the refcount taken in dnx_gpu_cmdbuf_lookup_objects */
+		drm_gem_object_unreference_unlocked(&obj->base);
+	}
+
+	if(buf->job)
+		dnx_job_put(buf->job);
+
+	if(buf->out_fence)
+		fence_put(buf->out_fence);
+
+	/* the callbacks ran before the cmdbuf was linked, if added at all */
+	for(i = 0; i < buf->nr_deps; i++)
+		fence_put(buf->deps[i].fence);
+	kfree(buf->deps);
+
+	if(buf->priv)
+		dnx_file_priv_put(buf->priv);
+
+	if(buf->cache >= 0)
+		kmem_cache_free(cmdbuf_caches[buf->cache], buf);
+	else
+		kfree(buf);
+}
+
+
+/* Makes the cmdbuf wait in the scheduler queue until fence signaled, takes
+ * over the reference. Of several fences of a context only the latest one is
+ * kept. */
+int dnx_gpu_cmdbuf_add_dep(struct dnx_cmdbuf *buf, struct fence *fence)
+{
+	struct dnx_cmdbuf_dep *deps;
+	unsigned int i;
+
+	if(fence_is_signaled(fence)) {
+		fence_put(fence);
+		return 0;
+	}
+
+	for(i = 0; i < buf->nr_deps; i++) {
+		struct dnx_cmdbuf_dep *dep = &buf->deps[i];
+
+		if(dep->fence->context != fence->context)
+			continue;
+
+		if(fence_is_later(fence, dep->fence)) {
+			fence_put(dep->fence);
+			dep->fence = fence;
+		}
+		else {
+			fence_put(fence);
+		}
+		return 0;
+	}
+
+	if(buf->nr_deps == buf->max_deps) {
+		unsigned int max = max(2 * buf->max_deps, 4U);
+
+		deps = krealloc(buf->deps, max * sizeof(*deps), GFP_KERNEL);
+		if(!deps) {
+			fence_put(fence);
+			return -ENOMEM;
+		}
+		buf->deps = deps;
+		buf->max_deps = max;
+	}
+
+	buf->deps[buf->nr_deps++].fence = fence;
+
+	return 0;
+}
+
+
+static void dnx_sched_dep_signaled(struct fence *fence, struct fence_cb *cb)
+{
+	struct dnx_cmdbuf_dep *dep = container_of(cb, struct dnx_cmdbuf_dep, cb);
+	struct dnx_device *dnx = dep->cmdbuf->dnx;
+
+	/* the cmdbuf may be gone right after the last one */
+	if(atomic_dec_and_test(&dep->cmdbuf->deps_pending))
+		queue_work(system_highpri_wq, &dnx->sched_work);
+}
+
+
+/* Adds the callbacks of the cmdbuf's deps, the scheduler runs once the last
+ * one signaled. Caller must hold the device's lock and run the scheduler. */
+static void dnx_sched_arm_deps(struct dnx_cmdbuf *buf)
+{
+	unsigned int i;
+
+	/* the extra count keeps the callbacks from kicking the scheduler */
+	atomic_set(&buf->deps_pending, buf->nr_deps + 1);
+
+	for(i = 0; i < buf->nr_deps; i++) {
+		struct dnx_cmdbuf_dep *dep = &buf->deps[i];
+
+		dep->cmdbuf = buf;
+		if(fence_add_callback(dep->fence, &dep->cb,
+				dnx_sched_dep_signaled))
+			atomic_dec(&buf->deps_pending);
+	}
+
+	atomic_dec(&buf->deps_pending);
 }
 
 
@@ -186,9 +654,9 @@ struct dnx_ringbuf *dnx_gpu_ringbuf_new(struct dnx_device *dnx, u32 size)
 {
 	struct dnx_ringbuf *ringbuf;
 
-	if(size != PAGE_SIZE)
+	if(!size || !PAGE_ALIGNED(size))
 	{
-		dev_err(dnx->dev, "%s currently not implemented properly: only capable of creating ring buffer\n", __func__);
+		dev_err(dnx->dev, "%s: ring buffer size 0x%x is not a multiple of the page size\n", __func__, size);
 		return NULL;
 	}
 
@@ -196,7 +664,12 @@ struct dnx_ringbuf *dnx_gpu_ringbuf_new(struct dnx_device *dnx, u32 size)
 	if(!ringbuf)
 		return NULL;
 
+	ringbuf->dnx = dnx;
 	ringbuf->vaddr = dma_alloc_writecombine(dnx->dev, size, &ringbuf->paddr, GFP_KERNEL);
+	if(!ringbuf->vaddr) {
+		kfree(ringbuf);
+		return NULL;
+	}
 	ringbuf->size = size;
 
 	return ringbuf;
@@ -210,60 +683,773 @@ void dnx_gpu_ringbuf_free(struct dnx_ringbuf *ringbuf)
 }
 
 
-int dnx_gpu_submit(struct dnx_device *dnx, struct dnx_cmdbuf *buf)
+/* Moves the ring tail past cmdbufs that completed but were not retired yet
+ * and returns the oldest one still pending, if any. Caller must hold the
+ * device's active_lock. */
+static struct dnx_cmdbuf *dnx_gpu_update_tail(struct dnx_device *dnx)
+{
+	struct dnx_cmdbuf *cmdbuf;
+
+	list_for_each_entry(cmdbuf, &dnx->active_cmd_list, node) {
+		if (!fence_completed(dnx, cmdbuf->fence))
+			return cmdbuf;
+
+		dnx_buffer_consumed(dnx, cmdbuf);
+	}
+
+	return NULL;
+}
+
+
+/* Watchdog, runs while jobs are linked into the ring. The core makes progress
+ * as long as the STC moves or jobs complete, so the timeout is for a single
+ * stream command rather than a whole job. */
+static void dnx_gpu_hangcheck(unsigned long data)
+{
+	struct dnx_device *dnx = (struct dnx_device *)data;
+	unsigned int timeout_ms = READ_ONCE(dnx_hang_timeout_ms);
+	u32 pos, sync;
+
+	if(!timeout_ms || READ_ONCE(dnx->hang_stopped) ||
+	   fence_completed(dnx, READ_ONCE(dnx->fence_active)))
+		return;
+
+	pos = dnx_reg_read(dnx, DNX_REG_CONTROL_STREAM_POS);
+	sync = dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0);
+
+	if(pos != dnx->hang_pos || sync != dnx->hang_sync) {
+		dnx->hang_pos = pos;
+		dnx->hang_sync = sync;
+		dnx->hang_progress = jiffies;
+	}
+	else if(time_after(jiffies, dnx->hang_progress +
+			msecs_to_jiffies(timeout_ms))) {
+		if(dnx->recover) {
+			/* re-armed after the replay */
+			queue_work(dnx->wq, &dnx->hang_work);
+			return;
+		}
+
+		dev_err(dnx->dev, "core hang up at 0x%08x, fence %u\n", pos, sync);
+		dnx->hang_progress = jiffies;
+	}
+
+	mod_timer(&dnx->hang_timer,
+			jiffies + msecs_to_jiffies(DNX_HANGCHECK_PERIOD_MS));
+}
+
+
+/* Starts the watchdog unless it is running already. */
+static void dnx_gpu_hangcheck_arm(struct dnx_device *dnx)
+{
+	if(timer_pending(&dnx->hang_timer) || READ_ONCE(dnx->hang_stopped))
+		return;
+
+	dnx->hang_progress = jiffies;
+	mod_timer(&dnx->hang_timer,
+			jiffies + msecs_to_jiffies(DNX_HANGCHECK_PERIOD_MS));
+}
+
+
+/* Picks the oldest cmdbuf of the client with the least vruntime, so each
+ * client's jobs stay in order. Clients whose oldest cmdbuf still waits for
+ * fences are passed over. Queues are short, a linear scan will do. */
+static struct dnx_cmdbuf *dnx_sched_pick(struct dnx_device *dnx,
+	struct list_head *queue)
 {
+	struct dnx_cmdbuf *cmdbuf, *best = NULL;
+	unsigned long scan = ++dnx->sched_scans;
+	u64 best_vruntime = 0;
+
+	list_for_each_entry(cmdbuf, queue, node) {
+		u64 vruntime = atomic64_read(&cmdbuf->priv->vruntime);
+
+		if(cmdbuf->priv->sched_blocked == scan)
+			continue;
+		if(atomic_read(&cmdbuf->deps_pending)) {
+			cmdbuf->priv->sched_blocked = scan;
+			continue;
+		}
+
+		if(!best || (s64)(vruntime - best_vruntime) < 0) {
+			best = cmdbuf;
+			best_vruntime = vruntime;
+		}
+	}
+
+	return best;
+}
+
+
+/* Charges the expected run time of a picked cmdbuf to its client, so a
+ * batch is spread across clients before the real times are known. */
+static void dnx_sched_charge(struct dnx_device *dnx, struct dnx_cmdbuf *cmdbuf)
+{
+	struct dnx_file_priv *priv = cmdbuf->priv;
+	u64 vruntime = atomic64_read(&priv->vruntime);
+	u64 charge = READ_ONCE(dnx->job_time_avg);
+	bool overtook;
+
+	if(!charge)
+		charge = DNX_FAIR_CHARGE_NS;
+
+	overtook = cmdbuf != list_first_entry(&dnx->sched_queue[cmdbuf->prio],
+			struct dnx_cmdbuf, node);
+	if(overtook)
+		atomic_inc(&dnx->stats.fair_overtakes);
+	trace_dnx_sched_pick(cmdbuf, vruntime, overtook);
+
+	if((s64)(vruntime - dnx->sched_min_vruntime) > 0)
+		dnx->sched_min_vruntime = vruntime;
+
+	cmdbuf->sched_charge = charge;
+	atomic64_add(charge, &priv->vruntime);
+}
+
+
+/* Places a client that had nothing queued next to the others, so it
+ * neither banks idle time nor has to catch up with a busy client. */
+static void dnx_sched_place_client(struct dnx_device *dnx,
+		struct dnx_file_priv *priv)
+{
+	u64 min = dnx->sched_min_vruntime - DNX_FAIR_SLEEPER_NS;
+	u64 vruntime = atomic64_read(&priv->vruntime);
+
+	if((s64)(vruntime - min) < 0)
+		atomic64_set(&priv->vruntime, min);
+}
+
+
+/* Links queued cmdbufs into the ring, highest priority first, while the
+ * hardware window and the ring have space. Within a priority, clients get
+ * the ring in turns by vruntime. Jobs can only overtake each other here,
+ * once linked they run in ring order. The batch is linked with a single
+ * ring update. Caller must hold the device's lock. */
+static void dnx_sched_run_locked(struct dnx_device *dnx)
+{
+	struct dnx_cmdbuf *batch[DNX_SCHED_WINDOW_MAX];
+	unsigned int inflight, room, nr = 0, i;
+	ktime_t now;
+	int prio;
+
+	inflight = dnx->fence_next - READ_ONCE(dnx->fence_completed);
+	if(inflight >= dnx->sched_window)
+		return;
+	room = dnx->sched_window - inflight;
+
+	spin_lock_irq(&dnx->active_lock);
+	dnx_gpu_update_tail(dnx);
+	while(room && !dnx_buffer_has_space(dnx, room))
+		room--;
+	spin_unlock_irq(&dnx->active_lock);
+
+	for(prio = DNX_SCHED_PRIOS - 1; prio >= 0 && nr < room; prio--) {
+		struct list_head *queue = &dnx->sched_queue[prio];
+
+		while(nr < room && !list_empty(queue)) {
+			batch[nr] = dnx_sched_pick(dnx, queue);
+			if(!batch[nr])
+				break;
+			dnx_sched_charge(dnx, batch[nr]);
+			list_del(&batch[nr]->node);
+			batch[nr]->priv->sched_queued--;
+			dnx->sched_count[prio]--;
+			nr++;
+		}
+	}
+
+	if(!nr)
+		return;
+
+	now = ktime_get();
+
+	/* the reference of the fence_list is dropped when signaling */
+	spin_lock_irq(&dnx->fence_lock);
+	for(i = 0; i < nr; i++) {
+		struct dnx_fence *f = to_dnx_fence(batch[i]->out_fence);
+
+		/* 0 marks fences that are not linked yet */
+		if(!++dnx->fence_next)
+			++dnx->fence_next;
+		batch[i]->fence = dnx->fence_next;
+		batch[i]->queued = now;
+
+		f->linked = now;
+		WRITE_ONCE(f->hw_seqno, batch[i]->fence);
+		list_add_tail(&f->node, &dnx->fence_list);
+		fence_get(&f->base);
+	}
+	spin_unlock_irq(&dnx->fence_lock);
+
+	dnx_buffer_queue_batch(dnx, batch, nr);
+	dnx_gpu_hangcheck_arm(dnx);
+
+	spin_lock_irq(&dnx->active_lock);
+	for(i = 0; i < nr; i++)
+		list_add_tail(&batch[i]->node, &dnx->active_cmd_list);
+	dnx->active_cmd_count += nr;
+	spin_unlock_irq(&dnx->active_lock);
+
+	spin_lock(&dnx->stats.lock);
+	for(i = 0; i < nr; i++)
+		dnx_hist_add(&dnx->stats.queue_wait,
+				ktime_us_delta(now, batch[i]->submitted));
+	dnx_hist_add(&dnx->stats.depth, dnx->active_cmd_count);
+	spin_unlock(&dnx->stats.lock);
+
+	wake_up_all(&dnx->sched_waitq);
+}
+
+
+/* Runs the scheduler when linked jobs completed. */
+static void sched_worker(struct work_struct *work)
+{
+	struct dnx_device *dnx = container_of(work, struct dnx_device, sched_work);
+
+	mutex_lock(&dnx->lock);
+	dnx_sched_run_locked(dnx);
+	mutex_unlock(&dnx->lock);
+}
+
+
+/* Resets the core and replays the jobs that were linked into the ring. Only
+ * the oldest pending job is blamed, its fence signals with -EIO. The others
+ * did not start yet, as the STC runs the ring in order. */
+void dnx_gpu_recover_hangup(struct dnx_device *dnx)
+{
+	struct dnx_cmdbuf *replay[DNX_SCHED_WINDOW_MAX];
+	struct dnx_cmdbuf *cmdbuf, *guilty;
+	unsigned int nr = 0;
+	u32 sync;
+
+	mutex_lock(&dnx->lock);
+	dnx_irq_disable(dnx);
+
+	/* jobs that completed before the reset stay completed */
+	sync = dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0);
+	dnx_hw_reset(dnx);
+
+	spin_lock_irq(&dnx->stc_lock);
+	dnx->stc_running = false;
+	if(fence_after(sync, dnx->fence_completed) &&
+	   !fence_after(sync, dnx->fence_next))
+		dnx->fence_completed = sync;
+	spin_unlock_irq(&dnx->stc_lock);
+
+	spin_lock_irq(&dnx->active_lock);
+	guilty = dnx_gpu_update_tail(dnx);
+	if(guilty) {
+		guilty->out_fence->status = -EIO;
+		dnx->fence_completed = guilty->fence;
+	}
+	spin_unlock_irq(&dnx->active_lock);
+
+	atomic_inc(&dnx->stats.hangs);
+	if(guilty)
+		dev_err(dnx->dev, "hang in job %u of client %llu, recovering\n",
+				dnx_gpu_fence_id(guilty->out_fence),
+				guilty->priv ? guilty->priv->id : 0);
+	else
+		dev_err(dnx->dev, "hang without pending jobs, recovering\n");
+
+	dnx_gpu_signal_fences(dnx);
+	wake_up_interruptible(&dnx->fence_waitq);
+
+	/* the retired jobs' ring positions are gone with the new ring */
+	dnx_gpu_retire(dnx);
+
+	spin_lock_irq(&dnx->active_lock);
+	dnx_buffer_init(dnx);
+	list_for_each_entry(cmdbuf, &dnx->active_cmd_list, node) {
+		if(WARN_ON(nr == DNX_SCHED_WINDOW_MAX))
+			break;
+		replay[nr++] = cmdbuf;
+	}
+	dnx->fence_active = dnx->fence_completed;
+	spin_unlock_irq(&dnx->active_lock);
+
+	if(nr) {
+		dev_info(dnx->dev, "replaying %u jobs\n", nr);
+		dnx_buffer_queue_batch(dnx, replay, nr);
+		dnx_gpu_hangcheck_arm(dnx);
+	}
+
+	dnx_irq_enable(dnx);
+
+	dnx_sched_run_locked(dnx);
+	mutex_unlock(&dnx->lock);
+}
+
+
+static void hang_worker(struct work_struct *work)
+{
+	struct dnx_device *dnx = container_of(work, struct dnx_device, hang_work);
+
+	dnx_gpu_recover_hangup(dnx);
+}
+
+
+/* Lets the scheduler link more jobs, called when linked jobs completed. */
+void dnx_gpu_sched_kick(struct dnx_device *dnx)
+{
+	unsigned int i;
+
+	for(i = 0; i < DNX_SCHED_PRIOS; i++) {
+		if(READ_ONCE(dnx->sched_count[i])) {
+			/* not on dnx->wq, that one may be busy retiring */
+			queue_work(system_highpri_wq, &dnx->sched_work);
+			break;
+		}
+	}
+}
+
+
+void dnx_gpu_client_add(struct dnx_device *dnx, struct dnx_file_priv *priv)
+{
+	priv->fence_context = fence_context_alloc(DNX_SCHED_PRIOS);
+
+	mutex_lock(&dnx->lock);
+	atomic64_set(&priv->vruntime, dnx->sched_min_vruntime);
+	list_add_tail(&priv->client_node, &dnx->client_list);
+	mutex_unlock(&dnx->lock);
+}
+
+
+/* The client's queued jobs still run, they hold a reference to priv. */
+void dnx_gpu_client_remove(struct dnx_device *dnx, struct dnx_file_priv *priv)
+{
+	mutex_lock(&dnx->lock);
+	list_del(&priv->client_node);
+	mutex_unlock(&dnx->lock);
+}
+
+
+/* Waits until the priority's queue takes nr more cmdbufs. Called before the
+ * bos of a submit are locked, dnx_gpu_submit_batch() fails with -ENOSPC if
+ * the queue filled up again meanwhile. */
+int dnx_gpu_sched_wait_space(struct dnx_device *dnx, unsigned int prio,
+		unsigned int nr)
+{
+	long ret;
+
+	if(prio >= DNX_SCHED_PRIOS || nr > DNX_SCHED_QUEUE_MAX)
+		return -EINVAL;
+
+	if(READ_ONCE(dnx->sched_count[prio]) + nr <= DNX_SCHED_QUEUE_MAX)
+		return 0;
+
+	dev_dbg(dnx->dev, "queue %u full, waiting\n", prio);
+
+	ret = wait_event_interruptible_timeout(dnx->sched_waitq,
+			READ_ONCE(dnx->sched_count[prio]) + nr <=
+				DNX_SCHED_QUEUE_MAX,
+			msecs_to_jiffies(DNX_SCHED_WAIT_MS));
+	if(ret == 0)
+		return -EBUSY;
+	if(ret < 0)
+		return ret;
+
+	return 0;
+}
+
+
+/* Ids are handed out cyclically from 1 to INT_MAX, so their order says nothing
+ * after a wrap. Whether a job is still around is only known by the idr. */
+static int dnx_gpu_fence_alloc_id(struct dnx_device *dnx, struct dnx_fence *f)
+{
+	int id;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock_irq(&dnx->fence_idr_lock);
+	id = idr_alloc_cyclic(&dnx->fence_idr, f, 1, 0, GFP_NOWAIT);
+	spin_unlock_irq(&dnx->fence_idr_lock);
+	idr_preload_end();
+
+	if(id < 0)
+		return id;
+
+	f->id = id;
+
+	return 0;
+}
+
+
+static void dnx_gpu_fence_free(struct dnx_device *dnx, struct dnx_fence *f)
+{
+	if(f->id) {
+		spin_lock_irq(&dnx->fence_idr_lock);
+		idr_remove(&dnx->fence_idr, f->id);
+		spin_unlock_irq(&dnx->fence_idr_lock);
+	}
+
+	kmem_cache_free(fence_cache, f);
+}
+
+
+/* The handle of one of our fences for userspace. */
+u32 dnx_gpu_fence_id(struct fence *fence)
+{
+	return to_dnx_fence(fence)->id;
+}
+
+
+/* true for ids dnx_gpu_fence_alloc_id() can hand out */
+static inline bool dnx_gpu_fence_id_valid(u32 id)
+{
+	return id >= 1 && id <= INT_MAX;
+}
+
+
+/* Returns a reference to the fence of a submitted job, or NULL if it is gone
+ * already, which only happens after it signaled. */
+static struct fence *dnx_gpu_fence_lookup(struct dnx_device *dnx, u32 id)
+{
+	struct dnx_fence *f;
+	struct fence *fence = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dnx->fence_idr_lock, flags);
+	f = idr_find(&dnx->fence_idr, id);
+	if(f)
+		fence = fence_get_rcu(&f->base);
+	spin_unlock_irqrestore(&dnx->fence_idr_lock, flags);
+
+	return fence;
+}
+
+
+/* Queues the nr buffers in bufs for execution in this order with the given
+ * priority and hands over their ownership. The buffers are linked into the
+ * ring by the scheduler, which runs right away. A reference to each buffer's
+ * fence is returned in fences. With sync_file, one is created for the last
+ * fence before the buffers are queued, nothing fails once they are. Fails
+ * with -ENOSPC if the queue is full, see dnx_gpu_sched_wait_space(). */
+int dnx_gpu_submit_batch(struct dnx_device *dnx, struct dnx_cmdbuf **bufs,
+	unsigned int nr, unsigned int prio, struct fence **fences,
+	struct sync_file **sync_file)
+{
+	struct dnx_fence *f;
+	unsigned int i;
+	int ret;
+
+	if(nr == 0 || nr > DNX_SCHED_QUEUE_MAX || prio >= DNX_SCHED_PRIOS)
+		return -EINVAL;
+
+	for(i = 0; i < nr; i++) {
+		f = kmem_cache_zalloc(fence_cache, GFP_KERNEL);
+		if(!f) {
+			ret = -ENOMEM;
+			goto error_fences;
+		}
+
+		f->dnx = dnx;
+		fences[i] = &f->base;
+	}
+
 	mutex_lock(&dnx->lock);
 
-	buf->fence = ++dnx->fence_next;
+	if(dnx->sched_count[prio] + nr > DNX_SCHED_QUEUE_MAX) {
+		ret = -ENOSPC;
+		goto error_unlock;
+	}
+
+	/* ids are taken under the lock, so they increase in submit order */
+	for(i = 0; i < nr; i++) {
+		ret = dnx_gpu_fence_alloc_id(dnx, to_dnx_fence(fences[i]));
+		if(ret) {
+			i = nr;
+			goto error_unlock;
+		}
+	}
+
+	for(i = 0; i < nr; i++) {
+		struct dnx_file_priv *priv = bufs[i]->priv;
 
-	dnx_buffer_queue(dnx, buf);
+		f = to_dnx_fence(fences[i]);
+
+		/* fences of a context signal in order, so each client and
+		 * priority has its own one, as clients overtake each other */
+		fence_init(&f->base, &dnx_fence_ops, &dnx->fence_lock,
+				priv->fence_context + prio,
+				++priv->fence_seqno[prio]);
+		bufs[i]->prio = prio;
+		bufs[i]->out_fence = fence_get(&f->base);
+	}
+
+	if(sync_file) {
+		*sync_file = sync_file_create(fences[nr - 1]);
+		if(!*sync_file) {
+			ret = -ENOMEM;
+			goto error_init;
+		}
+	}
+
+	/* has to happen before the buffers are visible to the scheduler, bos
+	 * listed by several buffers stay locked until all fences are in */
+	for(i = 0; i < nr; i++)
+		dnx_submit_attach_fence(bufs[i], bufs[i]->out_fence);
+	for(i = 0; i < nr; i++)
+		dnx_submit_unlock_objects(bufs[i]);
+
+	for(i = 0; i < nr; i++) {
+		dnx_sched_arm_deps(bufs[i]);
+		if(!bufs[i]->priv->sched_queued++)
+			dnx_sched_place_client(dnx, bufs[i]->priv);
+		list_add_tail(&bufs[i]->node, &dnx->sched_queue[prio]);
+	}
+	dnx->sched_count[prio] += nr;
 
-	list_add_tail(&buf->node, &dnx->active_cmd_list);
-	++dnx->active_cmd_count;
+	dnx_sched_run_locked(dnx);
 
 	mutex_unlock(&dnx->lock);
 
 	return 0;
+
+error_init:
+	/* the ids may have been looked up already, signal the fences as failed
+	 * so no waiter hangs, the release frees the ids */
+	for(i = 0; i < nr; i++) {
+		fences[i]->status = ret;
+		fence_signal(fences[i]);
+		fence_put(bufs[i]->out_fence);
+		bufs[i]->out_fence = NULL;
+		bufs[i]->priv->fence_seqno[prio]--;
+	}
+	mutex_unlock(&dnx->lock);
+
+	for(i = 0; i < nr; i++)
+		fence_put(fences[i]);
+
+	return ret;
+
+error_unlock:
+	mutex_unlock(&dnx->lock);
+error_fences:
+	while(i--)
+		dnx_gpu_fence_free(dnx, to_dnx_fence(fences[i]));
+
+	return ret;
+}
+
+
+/* Polls for a fence before sleeping on it. Short jobs complete sooner than a
+ * sleep and the wakeup from the irq thread take. The budget is twice the
+ * expected time until completion, polling is skipped if that exceeds the
+ * wait_spin_us parameter or the job is not linked into the ring yet. SYNC_0
+ * is read as well, as the irq thread might not have run yet. */
+static bool dnx_gpu_spin_fence(struct dnx_device *dnx, struct dnx_fence *f)
+{
+	u64 max = (u64)READ_ONCE(dnx_wait_spin_us) * NSEC_PER_USEC;
+	u32 fence = READ_ONCE(f->hw_seqno);
+	u64 budget;
+	ktime_t end;
+
+	if(!fence)
+		return false;
+
+	budget = (u64)READ_ONCE(dnx->job_time_avg) *
+		(u32)(fence - dnx->fence_completed);
+	if(!budget || budget > max)
+		return false;
+
+	end = ktime_add_ns(ktime_get(), min(2 * budget, max));
+
+	do {
+		if(fence_completed(dnx, fence))
+			return true;
+		if(fence_after_eq(dnx_reg_read(dnx, DNX_REG_CONTROL_SYNC_0), fence))
+			return true;
+		if(need_resched() || signal_pending(current))
+			break;
+		cpu_relax();
+	} while(ktime_before(ktime_get(), end));
+
+	return false;
 }
 
 
-int dnx_gpu_wait_fence_interruptible(struct dnx_device *dnx, u32 fence, struct timespec *timeout)
+/* Waits for the job with the fence id handed out at submit. */
+int dnx_gpu_wait_fence_interruptible(struct dnx_device *dnx, u32 id, struct timespec *timeout)
 {
+	struct fence *fence;
+	struct dnx_fence *f;
 	int ret;
 
-	if(fence_after(fence, dnx->fence_next)) {
-		dev_err(dnx->dev, "waiting on invalid fence: %u (of %u)\n", fence, dnx->fence_next);
+	if(!dnx_gpu_fence_id_valid(id)) {
+		dev_err(dnx->dev, "waiting on invalid fence: %u\n", id);
 		return -EINVAL;
 	}
 
+	/* only signaled fences are gone */
+	fence = dnx_gpu_fence_lookup(dnx, id);
+	if(!fence)
+		return 0;
+	f = to_dnx_fence(fence);
+
 	if(!timeout) {
-		ret = fence_completed(dnx, fence) ? 0 : -EBUSY;
+		ret = dnx_fence_signaled(fence) ? 0 : -EBUSY;
 	}
 	else {
 		unsigned long remaining = dnx_timeout_to_jiffies(timeout);
 		struct timespec t;
 		jiffies_to_timespec(jiffies - INITIAL_JIFFIES, &t);
 
+		if(remaining && dnx_gpu_spin_fence(dnx, f)) {
+			ret = 0;
+			goto out;
+		}
+
 //		dev_info(dnx->dev, "timeout: %lu jiffies\n", remaining);
 
-		ret = wait_event_interruptible_timeout(dnx->fence_waitq, fence_completed(dnx, fence), remaining);
+		ret = wait_event_interruptible_timeout(dnx->fence_waitq, dnx_fence_signaled(fence), remaining);
 
 		if(ret == 0) {
-			dev_err(dnx->dev, "timeout waiting for fence: %u (completed: %u)\n", fence, dnx->fence_completed);
+			dev_err(dnx->dev, "timeout waiting for fence: %u (hw %u, completed: %u)\n",
+					id, READ_ONCE(f->hw_seqno), dnx->fence_completed);
 			ret = -ETIMEDOUT;
-
-			if(dnx->recover) {
-				dev_err(dnx->dev, "core hang up! recovering...\n");
-				dnx_gpu_recover_hangup(dnx);
-			}
 		}
 		else if(ret != -ERESTARTSYS) {
 			ret = 0;
 		}
 	}
 
+	/* failed by the hang recovery */
+	if(ret == 0 && fence->status < 0)
+		ret = fence->status;
+
+out:
+	fence_put(fence);
+
 	return ret;
 }
 
 
+static bool dnx_gpu_fences_done(struct fence **fences, unsigned int nr,
+	bool any)
+{
+	unsigned int i, count = 0;
+
+	/* gone fences signaled */
+	for(i = 0; i < nr; i++)
+		if(!fences[i] || dnx_fence_signaled(fences[i]))
+			count++;
 
+	return any ? count > 0 : count == nr;
+}
+
+
+/* The pending fence ending the wait, the first one linked into the ring for
+ * any, the last one for all. An unlinked fence signals after all linked ones
+ * and can't be polled for. */
+static struct dnx_fence *dnx_gpu_fences_spin_target(struct fence **fences,
+	unsigned int nr, bool any)
+{
+	struct dnx_fence *target = NULL, *f;
+	unsigned int i;
+	u32 seqno;
+
+	for(i = 0; i < nr; i++) {
+		if(!fences[i] || dnx_fence_signaled(fences[i]))
+			continue;
+
+		f = to_dnx_fence(fences[i]);
+		seqno = READ_ONCE(f->hw_seqno);
+		if(!seqno) {
+			if(!any)
+				return NULL;
+			continue;
+		}
+
+		if(!target || (any ? fence_after(target->hw_seqno, seqno) :
+				fence_after(seqno, target->hw_seqno)))
+			target = f;
+	}
+
+	return target;
+}
+
+
+/* Waits for the first (any) or all of nr jobs with the fence ids handed out
+ * at submit, only checks without a timeout. The status of each fence goes to
+ * status, see DRM_IOCTL_DNX_WAIT_FENCES. */
+int dnx_gpu_wait_fences_interruptible(struct dnx_device *dnx, const u32 *ids,
+	unsigned int nr, bool any, struct timespec *timeout, s32 *status,
+	u32 *first)
+{
+	struct fence **fences;
+	struct dnx_fence *target;
+	unsigned int i;
+	int ret = 0;
+
+	for(i = 0; i < nr; i++) {
+		if(!dnx_gpu_fence_id_valid(ids[i])) {
+			dev_err(dnx->dev, "waiting on invalid fence: %u\n", ids[i]);
+			return -EINVAL;
+		}
+	}
+
+	fences = kcalloc(nr, sizeof(*fences), GFP_KERNEL);
+	if(!fences)
+		return -ENOMEM;
+
+	/* only signaled fences are gone */
+	for(i = 0; i < nr; i++)
+		fences[i] = dnx_gpu_fence_lookup(dnx, ids[i]);
+
+	if(dnx_gpu_fences_done(fences, nr, any)) {
+		ret = 0;
+	}
+	else if(!timeout) {
+		ret = -EBUSY;
+	}
+	else {
+		unsigned long remaining = dnx_timeout_to_jiffies(timeout);
+
+		/* polled like a single fence, a sync seen in SYNC_0 only is
+		 * signaled by the irq thread right after */
+		target = dnx_gpu_fences_spin_target(fences, nr, any);
+		if(remaining && target)
+			dnx_gpu_spin_fence(dnx, target);
+
+		ret = wait_event_interruptible_timeout(dnx->fence_waitq,
+				dnx_gpu_fences_done(fences, nr, any),
+				remaining);
+
+		if(ret == 0) {
+			dev_dbg(dnx->dev, "timeout waiting for %u fences (completed: %u)\n",
+					nr, dnx->fence_completed);
+			ret = -ETIMEDOUT;
+		}
+		else if(ret != -ERESTARTSYS) {
+			ret = 0;
+		}
+	}
+
+	*first = nr;
+	for(i = 0; i < nr; i++) {
+		s32 err = 0;
+
+		if(fences[i] && !dnx_fence_signaled(fences[i]))
+			err = -EBUSY;
+		else if(fences[i] && fences[i]->status < 0)
+			err = fences[i]->status;
+
+		status[i] = err;
+		if(err == -EBUSY)
+			continue;
+
+		if(*first == nr)
+			*first = i;
+
+		/* failed by the hang recovery */
+		if(ret == 0 && err < 0 && (!any || i == *first))
+			ret = err;
+	}
+
+	for(i = 0; i < nr; i++)
+		if(fences[i])
+			fence_put(fences[i]);
+	kfree(fences);
+
+	return ret;
+}
@@ -4,25 +4,48 @@
 
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/fence.h>
+#include <linux/idr.h>
+#include <linux/interval_tree.h>
 #include <drm/drm_gem_cma_helper.h>
 
 #include "dnx_drv.h"
+#include "dnx_gem_cache.h"
+#include "dnx_stats.h"
 
 
-#define DNX_RINGBUFFER_SIZE PAGE_SIZE
+#define DNX_RINGBUFFER_PAGES (4)
 #define DNX_RINGBUFFER_MAX_SLOTS (128)
+#define DNX_STC_START_POLLS (64) /* busy polls for the STC restarting in irq */
+#define DNX_WAIT_SPIN_US (50) /* default max. time to poll for a fence */
+#define DNX_HANG_TIMEOUT_MS (2000) /* default time without progress of the STC */
+#define DNX_HANGCHECK_PERIOD_MS (250)
+
+#define DNX_SCHED_QUEUE_MAX (256) /* queued cmdbufs per priority */
+#define DNX_SCHED_WAIT_MS (1000) /* max. time to wait for queue space */
+#define DNX_SCHED_WINDOW (8) /* default max. of cmdbufs linked into the ring */
+#define DNX_SCHED_WINDOW_MAX (32)
+#define DNX_FAIR_CHARGE_NS (100000) /* charge per job until timings are known */
+#define DNX_FAIR_SLEEPER_NS (2000000) /* max. credit of a client waking up */
+
+/* bo capacities of the cmdbuf slab caches, larger cmdbufs use kmalloc */
+#define DNX_CMDBUF_CACHE_BOS { 4, 16, 64 }
+#define DNX_CMDBUF_CACHES (3)
 
 
 struct dnx_cmdbuf;
+struct sync_file;
 
 struct dnx_device {
 	struct device     *dev;
 	struct drm_device *drm;
-	struct mutex lock;
+	struct mutex lock; /* serializes submits, protects the ring's head and
+	                    * the scheduler queues */
 
 
 	void __iomem      *mmio;
 	resource_size_t    mmio_size;
+	struct dnx_emu    *emu; /* emulated core instead of mmio, see dnx_emu.c */
 
 	int irq;
 
@@ -34,23 +57,65 @@ struct dnx_device {
 
 	/* ring-buffer */
 	struct dnx_ringbuf *buffer;
+	u32 ring_size;
 	bool stc_running;
 	spinlock_t stc_lock; /* synchronization of user/irq context STC triggering */
 
+	/* irq state latched by the hard irq handler for the irq thread */
+	spinlock_t irq_lock;
+	u32 irq_status;
+	bool irq_stc_stalled;
+
 	/* list of currently in-flight command buffers */
+	spinlock_t active_lock; /* protects active_cmd_list and the ring's tail */
 	struct list_head active_cmd_list;
 	u32 active_cmd_count;
 
+	/* bos of all cmdbufs by GPU address, see dnx_gpu_cmdbuf_track() */
+	spinlock_t bo_tree_lock;
+	struct rb_root bo_tree;
+
+	/* Scheduling, cmdbufs wait here until linked into the ring */
+	struct list_head sched_queue[DNX_SCHED_PRIOS];
+	unsigned int sched_count[DNX_SCHED_PRIOS];
+	unsigned int sched_window; /* max. cmdbufs linked into the ring */
+	struct list_head client_list; /* open files, see dnx_file_priv */
+	u64 sched_min_vruntime; /* vruntime of the last picked client */
+	unsigned long sched_scans; /* dnx_sched_pick() runs */
+	wait_queue_head_t sched_waitq; /* space in the queues */
+	struct work_struct sched_work;
+
+	/* Hang watchdog, see dnx_gpu_hangcheck() */
+	struct timer_list hang_timer;
+	struct work_struct hang_work;
+	unsigned long hang_progress; /* jiffies of the last progress seen */
+	u32 hang_pos;
+	u32 hang_sync;
+	bool hang_stopped; /* no re-arming once set, see dnx_gpu_release() */
+
 	/* worker for handling active-list retiring: */
 	struct work_struct retire_work;
 	struct workqueue_struct *wq;
 
 	/* Fencing */
-	u32 fence_completed;
+	u32 fence_completed; /* hardware sync ids, in ring order */
 	u32 fence_next;
 	u32 fence_active;
 	u32 fence_retired;
 	wait_queue_head_t fence_waitq;
+	spinlock_t fence_lock; /* lock of all fences, protects fence_list */
+	struct list_head fence_list; /* linked fences not signaled yet */
+	spinlock_t fence_idr_lock;
+	struct idr fence_idr; /* fence ids for userspace */
+
+	/* Job timing, for spinning on short jobs */
+	ktime_t sync_time; /* latched with fence_completed */
+	ktime_t sync_time_prev; /* protected by fence_lock */
+	u32 job_time_avg; /* ns, average of recent jobs, by fence_lock */
+
+	struct dnx_stats stats;
+
+	struct dnx_gem_cache bo_cache;
 
 	/* Debug */
 	volatile u32 debug_irq;
@@ -65,20 +130,77 @@ struct dnx_ringbuf {
 	dma_addr_t paddr;
 	u32 size;
 	u32 user_size;
+	u32 tail; /* oldest word the STC may still fetch */
+	u32 wraps; /* wrap arounds of the head */
+	u32 tail_wraps; /* wrap arounds up to the tail's lap */
 	u32 fence;
 };
 
+struct dnx_fence {
+	struct fence base;
+	struct dnx_device *dnx;
+	struct list_head node; /* dnx_device's fence_list, once linked */
+	ktime_t linked;
+	u32 id; /* handle for userspace */
+	u32 hw_seqno; /* sync id in the ring, 0 until linked */
+};
+
+/* driver internal bo flag next to DNX_SUBMIT_BO_x: reservation is locked */
+#define DNX_CMDBUF_BO_LOCKED 0x80000000
+
+struct dnx_cmdbuf_bo {
+	u32 flags;
+	struct drm_gem_cma_object *obj;
+	struct interval_tree_node it; /* in the device's bo_tree */
+	struct dnx_cmdbuf *cmdbuf;
+};
+
+/* fence a queued cmdbuf waits for before it is linked into the ring */
+struct dnx_cmdbuf_dep {
+	struct fence *fence;
+	struct fence_cb cb;
+	struct dnx_cmdbuf *cmdbuf;
+};
+
 struct dnx_cmdbuf {
 	struct dnx_device *dnx;
 	dma_addr_t paddr; /* start address of stream */
 	void* vjmpaddr; /* jump command kernel space address to patch in stream */
-	u32 fence; /* fence after which this buffer is to be disposed */
-	struct list_head node; /* GPU in-flight list */
+	struct dnx_gem_object *jmp_bo; /* stream bo vjmpaddr points into */
+	struct dnx_job *job; /* holds the bo references if set */
+	bool tracked; /* bos are in the device's bo_tree */
+	u32 fence; /* hardware sync id, assigned when linked into the ring */
+	u32 ring_pos; /* ring offset of the sync/return section */
+	u32 ring_wraps; /* ring's wraps when linked, the lap of ring_pos */
+	struct fence *out_fence; /* signaled by the sync IRQ of this buffer */
+	struct list_head node; /* scheduler queue, then GPU in-flight list */
+	int cache; /* index of the slab cache or -1 */
+	unsigned int prio;
+	struct dnx_file_priv *priv; /* submitting client */
+	u64 sched_charge; /* ns added to the client's vruntime when linked */
+	struct dnx_cmdbuf_dep *deps; /* in and implicit fences */
+	unsigned int nr_deps;
+	unsigned int max_deps;
+	atomic_t deps_pending; /* unsignaled deps, linked at 0 */
+	ktime_t submitted; /* handed in by userspace */
+	ktime_t queued; /* linked into the ring */
 	unsigned int nr_bos;
-	struct drm_gem_cma_object *bos[0];
+	struct dnx_cmdbuf_bo bos[0];
 };
 
 
+/* persistent job of JOB_NEW, runs are copies of the cmdbuf */
+struct dnx_job {
+	struct kref ref;
+	u32 id;
+	struct mutex lock; /* one run at a time */
+	struct fence *last; /* of the latest run */
+	struct dnx_cmdbuf *cmdbuf; /* holds the bo references, never queued */
+};
+
+void dnx_job_put(struct dnx_job *job);
+
+
 static inline void dnx_queue_work(struct drm_device *dev,
 	struct work_struct *w)
 {
@@ -88,19 +210,39 @@ static inline void dnx_queue_work(struct drm_device *dev,
 }
 
 
+int dnx_gpu_cache_init(void);
+void dnx_gpu_cache_fini(void);
 int dnx_gpu_init(struct dnx_device *dnx);
 void dnx_gpu_release(struct dnx_device *dnx);
 void dnx_hw_reset(struct dnx_device *dnx);
 
 struct dnx_cmdbuf *dnx_gpu_cmdbuf_new(struct dnx_device *dnx, size_t nr_bo);
 int dnx_gpu_cmdbuf_lookup_objects(struct dnx_cmdbuf *buf,
-	struct drm_file *file, u32 *handles, unsigned nr_bos);
+	struct drm_file *file, struct drm_dnx_submit_bo *bos, unsigned nr_bos);
 void dnx_gpu_cmdbuf_free(struct dnx_cmdbuf *buf);
+void dnx_gpu_cmdbuf_track(struct dnx_cmdbuf *buf);
+int dnx_gpu_cmdbuf_add_dep(struct dnx_cmdbuf *buf, struct fence *fence);
+struct dnx_cmdbuf_bo *dnx_gpu_lookup_bo(struct dnx_device *dnx,
+	dma_addr_t addr, struct dnx_cmdbuf *cmdbuf);
 struct dnx_ringbuf *dnx_gpu_ringbuf_new(struct dnx_device *dnx, u32 size);
 void dnx_gpu_ringbuf_free(struct dnx_ringbuf *cmdbuf);
 
-int dnx_gpu_submit(struct dnx_device *dnx, struct dnx_cmdbuf *buf);
-int dnx_gpu_wait_fence_interruptible(struct dnx_device *dnx, u32 fence, struct timespec *timeout);
+int dnx_gpu_sched_wait_space(struct dnx_device *dnx, unsigned int prio,
+	unsigned int nr);
+int dnx_gpu_submit_batch(struct dnx_device *dnx, struct dnx_cmdbuf **bufs,
+	unsigned int nr, unsigned int prio, struct fence **fences,
+	struct sync_file **sync_file);
+u32 dnx_gpu_fence_id(struct fence *fence);
+void dnx_gpu_signal_fences(struct dnx_device *dnx);
+void dnx_submit_attach_fence(struct dnx_cmdbuf *buf, struct fence *fence);
+void dnx_submit_unlock_objects(struct dnx_cmdbuf *buf);
+int dnx_gpu_wait_fence_interruptible(struct dnx_device *dnx, u32 id, struct timespec *timeout);
+int dnx_gpu_wait_fences_interruptible(struct dnx_device *dnx, const u32 *ids,
+	unsigned int nr, bool any, struct timespec *timeout, s32 *status,
+	u32 *first);
+void dnx_gpu_sched_kick(struct dnx_device *dnx);
+void dnx_gpu_client_add(struct dnx_device *dnx, struct dnx_file_priv *priv);
+void dnx_gpu_client_remove(struct dnx_device *dnx, struct dnx_file_priv *priv);
 
 void dnx_gpu_recover_hangup(struct dnx_device *dnx);
 
@@ -110,5 +252,12 @@ static inline bool fence_completed(struct dnx_device *dnx, u32 fence)
 	return fence_after_eq(dnx->fence_completed, fence);
 }
 
+/* true while jobs linked into the ring have not synced yet, the STC has to
+ * run then */
+static inline bool dnx_stc_pending(struct dnx_device *dnx)
+{
+	return fence_after(dnx->fence_active, dnx->fence_completed);
+}
+
 
 #endif
@@ -0,0 +1,72 @@
+#include "dnx_stats.h"
+
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+
+void dnx_stats_init(struct dnx_stats *stats)
+{
+	spin_lock_init(&stats->lock);
+	dnx_stats_reset(stats);
+}
+
+
+void dnx_stats_reset(struct dnx_stats *stats)
+{
+	spin_lock(&stats->lock);
+	memset(&stats->queue_wait, 0, sizeof(stats->queue_wait));
+	memset(&stats->exec, 0, sizeof(stats->exec));
+	memset(&stats->total, 0, sizeof(stats->total));
+	memset(&stats->depth, 0, sizeof(stats->depth));
+	stats->last_done = 0;
+	spin_unlock(&stats->lock);
+
+	atomic_set(&stats->ring_wraps, 0);
+	atomic_set(&stats->stc_kicks, 0);
+	atomic_set(&stats->stc_restarts, 0);
+	atomic_set(&stats->fair_overtakes, 0);
+	atomic_set(&stats->hangs, 0);
+}
+
+
+/* Caller must hold the stats' lock. */
+void dnx_hist_add(struct dnx_hist *hist, u64 val)
+{
+	unsigned int bucket = min_t(unsigned int, fls64(val),
+			DNX_HIST_BUCKETS - 1);
+
+	hist->count[bucket]++;
+	hist->samples++;
+	hist->sum += val;
+	if(val > hist->max)
+		hist->max = val;
+}
+
+
+/* Prints the non-empty buckets as "[lower, upper) count". Works on a copy
+ * taken under the stats' lock. */
+void dnx_hist_show(struct seq_file *m, const char *name, const char *unit,
+		const struct dnx_hist *hist)
+{
+	unsigned int i;
+
+	seq_printf(m, "%s (%s): samples %llu avg %llu max %llu\n", name, unit,
+			hist->samples,
+			hist->samples ? div64_u64(hist->sum, hist->samples) : 0,
+			hist->max);
+
+	for(i = 0; i < DNX_HIST_BUCKETS; i++) {
+		u64 lower = i ? 1ULL << (i - 1) : 0;
+
+		if(!hist->count[i])
+			continue;
+
+		if(i == DNX_HIST_BUCKETS - 1)
+			seq_printf(m, "\t[%llu, ...)\t%u\n", lower, hist->count[i]);
+		else
+			seq_printf(m, "\t[%llu, %llu)\t%u\n", lower, 1ULL << i,
+					hist->count[i]);
+	}
+}
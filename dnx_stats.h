@@ -0,0 +1,48 @@
+#ifndef _DNX_STATS_H_
+#define _DNX_STATS_H_
+
+
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+
+struct seq_file;
+
+
+/* bucket 0 counts zeros, bucket n values in [2^(n-1), 2^n), the last one
+ * everything above */
+#define DNX_HIST_BUCKETS (24)
+
+struct dnx_hist {
+	u32 count[DNX_HIST_BUCKETS];
+	u64 samples;
+	u64 sum;
+	u64 max;
+};
+
+struct dnx_stats {
+	spinlock_t lock; /* protects the histograms and last_done */
+
+	struct dnx_hist queue_wait; /* us, submit ioctl until linked into ring */
+	struct dnx_hist exec;       /* us, job start until its sync irq */
+	struct dnx_hist total;      /* us, submit ioctl until retired */
+	struct dnx_hist depth;      /* in-flight cmdbufs after a submit */
+	ktime_t last_done;          /* sync of the last retired cmdbuf */
+
+	atomic_t ring_wraps;
+	atomic_t stc_kicks;
+	atomic_t stc_restarts;
+	atomic_t fair_overtakes; /* cmdbufs linked ahead of older ones */
+	atomic_t hangs;
+};
+
+
+void dnx_stats_init(struct dnx_stats *stats);
+void dnx_stats_reset(struct dnx_stats *stats);
+void dnx_hist_add(struct dnx_hist *hist, u64 val);
+void dnx_hist_show(struct seq_file *m, const char *name, const char *unit,
+		const struct dnx_hist *hist);
+
+
+#endif /* _DNX_STATS_H_ */
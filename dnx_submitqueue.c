@@ -0,0 +1,110 @@
+#include "dnx_drv.h"
+
+#include <linux/capability.h>
+#include <linux/idr.h>
+#include <linux/slab.h>
+
+#include "dnx_gpu.h"
+
+
+struct dnx_submitqueue {
+	u32 id;
+	unsigned int prio;
+};
+
+
+/* Looks up the priority of a file's submit queue, 0 is the default queue. */
+int dnx_submitqueue_prio(struct dnx_file_priv *priv, u32 id,
+		unsigned int *prio)
+{
+	struct dnx_submitqueue *queue;
+
+	if(id == 0) {
+		*prio = DNX_SUBMITQUEUE_PRIO_NORMAL;
+		return 0;
+	}
+
+	spin_lock(&priv->queue_lock);
+	queue = idr_find(&priv->queues, id);
+	if(queue)
+		*prio = queue->prio;
+	spin_unlock(&priv->queue_lock);
+
+	return queue ? 0 : -ENOENT;
+}
+
+
+int dnx_ioctl_submitqueue_new(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct drm_dnx_submitqueue *args = data;
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct dnx_submitqueue *queue;
+	int ret;
+
+	if(args->flags || args->prio > DNX_SUBMITQUEUE_PRIO_HIGH)
+		return -EINVAL;
+
+	/* high priority may starve everybody else */
+	if(args->prio == DNX_SUBMITQUEUE_PRIO_HIGH && !capable(CAP_SYS_NICE))
+		return -EACCES;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if(!queue)
+		return -ENOMEM;
+	queue->prio = args->prio;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&priv->queue_lock);
+	ret = idr_alloc(&priv->queues, queue, 1, 0, GFP_NOWAIT);
+	if(ret > 0)
+		queue->id = ret;
+	spin_unlock(&priv->queue_lock);
+	idr_preload_end();
+
+	if(ret < 0) {
+		kfree(queue);
+		return ret;
+	}
+
+	args->id = queue->id;
+
+	return 0;
+}
+
+
+/* Jobs already submitted to the queue still execute. */
+int dnx_ioctl_submitqueue_close(struct drm_device *dev, void *data,
+		struct drm_file *file)
+{
+	struct dnx_file_priv *priv = file->driver_priv;
+	struct dnx_submitqueue *queue;
+	u32 *id = data;
+
+	if(*id == 0)
+		return -EINVAL;
+
+	spin_lock(&priv->queue_lock);
+	queue = idr_find(&priv->queues, *id);
+	if(queue)
+		idr_remove(&priv->queues, *id);
+	spin_unlock(&priv->queue_lock);
+
+	if(!queue)
+		return -ENOENT;
+
+	kfree(queue);
+
+	return 0;
+}
+
+
+void dnx_submitqueue_close_all(struct dnx_file_priv *priv)
+{
+	struct dnx_submitqueue *queue;
+	int id;
+
+	idr_for_each_entry(&priv->queues, queue, id)
+		kfree(queue);
+	idr_destroy(&priv->queues);
+}
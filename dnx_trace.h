@@ -0,0 +1,198 @@
+#if !defined(_DNX_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _DNX_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+#include "dnx_gpu.h"
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dnx
+#define TRACE_INCLUDE_FILE dnx_trace
+
+
+/* stream handed in by userspace, before it gets a fence */
+TRACE_EVENT(dnx_submit,
+	TP_PROTO(struct dnx_device *dnx, u64 stream, u32 nr_bos),
+	TP_ARGS(dnx, stream, nr_bos),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dnx->dev))
+		__field(u64, stream)
+		__field(u32, nr_bos)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dnx->dev));
+		__entry->stream = stream;
+		__entry->nr_bos = nr_bos;
+	),
+
+	TP_printk("dev=%s stream=0x%llx nr_bos=%u",
+		__get_str(dev), __entry->stream, __entry->nr_bos)
+);
+
+DECLARE_EVENT_CLASS(dnx_cmdbuf,
+	TP_PROTO(struct dnx_cmdbuf *cmdbuf),
+	TP_ARGS(cmdbuf),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(cmdbuf->dnx->dev))
+		__field(u32, fence)
+		__field(u32, stream)
+		__field(u32, nr_bos)
+		__field(u32, ring_pos)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(cmdbuf->dnx->dev));
+		__entry->fence = cmdbuf->fence;
+		__entry->stream = cmdbuf->paddr;
+		__entry->nr_bos = cmdbuf->nr_bos;
+		__entry->ring_pos = cmdbuf->ring_pos;
+	),
+
+	TP_printk("dev=%s fence=%u stream=0x%08x nr_bos=%u ring_pos=0x%x",
+		__get_str(dev), __entry->fence, __entry->stream,
+		__entry->nr_bos, __entry->ring_pos)
+);
+
+/* cmdbuf linked into the ring */
+DEFINE_EVENT(dnx_cmdbuf, dnx_queue,
+	TP_PROTO(struct dnx_cmdbuf *cmdbuf),
+	TP_ARGS(cmdbuf)
+);
+
+/* cmdbuf freed by the retire worker */
+DEFINE_EVENT(dnx_cmdbuf, dnx_retire,
+	TP_PROTO(struct dnx_cmdbuf *cmdbuf),
+	TP_ARGS(cmdbuf)
+);
+
+/* cmdbuf picked by the scheduler, vruntime is the client's before charging
+ * it, overtook tells if older cmdbufs of other clients were left queued */
+TRACE_EVENT(dnx_sched_pick,
+	TP_PROTO(struct dnx_cmdbuf *cmdbuf, u64 vruntime, bool overtook),
+	TP_ARGS(cmdbuf, vruntime, overtook),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(cmdbuf->dnx->dev))
+		__field(u64, client)
+		__field(u64, vruntime)
+		__field(u32, stream)
+		__field(unsigned int, prio)
+		__field(bool, overtook)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(cmdbuf->dnx->dev));
+		__entry->client = cmdbuf->priv->id;
+		__entry->vruntime = vruntime;
+		__entry->stream = cmdbuf->paddr;
+		__entry->prio = cmdbuf->prio;
+		__entry->overtook = overtook;
+	),
+
+	TP_printk("dev=%s client=%llu vruntime=%llu stream=0x%08x prio=%u overtook=%d",
+		__get_str(dev), __entry->client, __entry->vruntime,
+		__entry->stream, __entry->prio, __entry->overtook)
+);
+
+/* ring updated for the jobs up to fence, started tells if the STC was idle
+ * and got kicked */
+TRACE_EVENT(dnx_stc_kick,
+	TP_PROTO(struct dnx_device *dnx, u32 fence, u32 addr, bool started),
+	TP_ARGS(dnx, fence, addr, started),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dnx->dev))
+		__field(u32, fence)
+		__field(u32, addr)
+		__field(bool, started)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dnx->dev));
+		__entry->fence = fence;
+		__entry->addr = addr;
+		__entry->started = started;
+	),
+
+	TP_printk("dev=%s fence=%u addr=0x%08x started=%d",
+		__get_str(dev), __entry->fence, __entry->addr,
+		__entry->started)
+);
+
+/* STREAM_DONE irq, running tells if the STC was restarted at pos */
+TRACE_EVENT(dnx_stc_done,
+	TP_PROTO(struct dnx_device *dnx, u32 pos, bool running),
+	TP_ARGS(dnx, pos, running),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dnx->dev))
+		__field(u32, completed)
+		__field(u32, active)
+		__field(u32, pos)
+		__field(bool, running)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dnx->dev));
+		__entry->completed = dnx->fence_completed;
+		__entry->active = dnx->fence_active;
+		__entry->pos = pos;
+		__entry->running = running;
+	),
+
+	TP_printk("dev=%s completed=%u active=%u pos=0x%08x running=%d",
+		__get_str(dev), __entry->completed, __entry->active,
+		__entry->pos, __entry->running)
+);
+
+/* STREAM_SYNC irq, all jobs up to completed are done */
+TRACE_EVENT(dnx_sync_irq,
+	TP_PROTO(struct dnx_device *dnx),
+	TP_ARGS(dnx),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dnx->dev))
+		__field(u32, completed)
+		__field(u32, active)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dnx->dev));
+		__entry->completed = dnx->fence_completed;
+		__entry->active = dnx->fence_active;
+	),
+
+	TP_printk("dev=%s completed=%u active=%u",
+		__get_str(dev), __entry->completed, __entry->active)
+);
+
+/* fence signaled by the irq thread, fence is the hardware sync id like in
+ * dnx_queue and dnx_retire, id the one of userspace */
+TRACE_EVENT(dnx_fence_signal,
+	TP_PROTO(struct dnx_device *dnx, struct dnx_fence *f),
+	TP_ARGS(dnx, f),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dnx->dev))
+		__field(u32, fence)
+		__field(u32, id)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dnx->dev));
+		__entry->fence = f->hw_seqno;
+		__entry->id = f->id;
+	),
+
+	TP_printk("dev=%s fence=%u id=%u", __get_str(dev), __entry->fence,
+		__entry->id)
+);
+
+#endif /* _DNX_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
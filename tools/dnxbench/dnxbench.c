@@ -0,0 +1,781 @@
+/*
+ * Submission benchmark of the dnx driver. Opens the render node and
+ * measures
+ *
+ *   gem      GEM_NEW, mmap and close per bo size and caching
+ *   submit   STREAM_SUBMIT_EXT throughput by number of bos
+ *   latency  submit to WAIT_FENCE round trips
+ *   scaling  submit throughput of 1 to N threads sharing a file and of
+ *            1 to N processes with a file each
+ *
+ * Results go to stdout as JSON, diagnostics to stderr. Without the board,
+ * load the module with emulate=1 and the benchmark runs against the
+ * emulated core.
+ *
+ * Streams are a single JMP back into the ring, so the numbers are the
+ * driver's overhead rather than the core's. A stream bo is reused once
+ * its previous run completed, the driver patches its jump while in flight.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <xf86drm.h>
+
+#include "dnx_drm_ext.h"
+
+/* the SDK's types are those of the kernel */
+typedef uint32_t u32;
+#include "nx_types.h"
+
+
+#define DNX_DRIVER_NAME "tes-dnx"
+#define RENDER_MINOR_FIRST (128)
+#define RENDER_MINOR_LAST (191)
+
+#define STREAMS (64) /* stream bos per submitter, round robin */
+#define STREAM_SIZE (64)
+#define EXTRA_BO_SIZE (4096)
+#define MAX_BOS (64)
+#define MAX_WORKERS (64)
+#define WAIT_TIMEOUT_NS (2000000000LL)
+#define GEM_BYTES_MAX (256 << 20) /* per size, fewer iterations for large bos */
+
+static const size_t gem_sizes[] = {
+	256, 4096, 16384, 65536, 262144, 1048576, 4194304,
+};
+
+static const struct {
+	const char *name;
+	uint32_t flags;
+} gem_cachings[] = {
+	{ "wc", DNX_BO_WC },
+	{ "cached", DNX_BO_CACHED },
+	{ "uncached", DNX_BO_UNCACHED },
+	{ "suballoc", DNX_BO_WC | DNX_BO_SUBALLOC },
+};
+
+static const unsigned int submit_bos[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static struct {
+	const char *device;
+	unsigned int gem_iters;
+	unsigned int submits;
+	unsigned int samples;
+	unsigned int workers;
+	unsigned int duration_ms;
+	bool gem, submit, latency, scaling;
+} opts = {
+	.gem_iters = 1000,
+	.submits = 20000,
+	.samples = 5000,
+	.workers = 4,
+	.duration_ms = 1000,
+};
+
+struct bo {
+	uint32_t handle;
+	uint64_t paddr;
+	size_t size;
+	void *map;
+};
+
+struct stream {
+	struct bo bo;
+	uint32_t fence; /* of the last submit, 0 if none */
+};
+
+/* per thread or process, all on the same file for threads */
+struct submitter {
+	int fd;
+	struct stream streams[STREAMS];
+	unsigned int next;
+	struct bo extra[MAX_BOS - 1]; /* submitted with the stream */
+	unsigned int nr_extra;
+	struct drm_dnx_submit_bo bos[MAX_BOS];
+	uint32_t last; /* fence of the last submit */
+};
+
+
+static void die(const char *what, int err)
+{
+	fprintf(stderr, "dnxbench: %s: %s\n", what, strerror(err));
+	exit(1);
+}
+
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int dnx_open_node(const char *path)
+{
+	drmVersionPtr version;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+
+	version = drmGetVersion(fd);
+	if(!version || strcmp(version->name, DNX_DRIVER_NAME)) {
+		drmFreeVersion(version);
+		close(fd);
+		return -1;
+	}
+	drmFreeVersion(version);
+
+	return fd;
+}
+
+
+/* The node given with -d, else the first render node of the driver. */
+static int dnx_open(char *path, size_t len)
+{
+	int minor, fd;
+
+	if(opts.device) {
+		fd = dnx_open_node(opts.device);
+		if(fd < 0)
+			die(opts.device, errno ? errno : ENODEV);
+		snprintf(path, len, "%s", opts.device);
+		return fd;
+	}
+
+	for(minor = RENDER_MINOR_FIRST; minor <= RENDER_MINOR_LAST; minor++) {
+		snprintf(path, len, "/dev/dri/renderD%d", minor);
+		fd = dnx_open_node(path);
+		if(fd >= 0)
+			return fd;
+	}
+
+	die("no " DNX_DRIVER_NAME " render node", ENODEV);
+	return -1;
+}
+
+
+static int bo_new(int fd, size_t size, uint32_t flags, struct bo *bo)
+{
+	struct drm_dnx_gem_new req = {
+		.size = size,
+		.flags = flags,
+	};
+
+	if(drmIoctl(fd, DRM_IOCTL_DNX_GEM_NEW, &req))
+		return -errno;
+
+	bo->handle = req.handle;
+	bo->paddr = req.paddr;
+	bo->size = size;
+	bo->map = NULL;
+
+	return 0;
+}
+
+
+static int bo_map(int fd, struct bo *bo)
+{
+	struct drm_dnx_gem_info req = {
+		.handle = bo->handle,
+	};
+	void *map;
+
+	if(drmIoctl(fd, DRM_IOCTL_DNX_GEM_INFO, &req))
+		return -errno;
+
+	map = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			req.offset);
+	if(map == MAP_FAILED)
+		return -errno;
+
+	bo->map = map;
+
+	return 0;
+}
+
+
+static void bo_free(int fd, struct bo *bo)
+{
+	struct drm_gem_close req = {
+		.handle = bo->handle,
+	};
+
+	if(bo->map)
+		munmap(bo->map, bo->size);
+	bo->map = NULL;
+
+	if(drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &req))
+		die("GEM_CLOSE", errno);
+}
+
+
+static int wait_fence(int fd, uint32_t fence)
+{
+	int64_t timeout = now_ns() + WAIT_TIMEOUT_NS;
+	struct drm_dnx_wait_fence req = {
+		.fence = fence,
+		.timeout = {
+			.tv_sec = timeout / 1000000000LL,
+			.tv_nsec = timeout % 1000000000LL,
+		},
+	};
+
+	if(drmIoctl(fd, DRM_IOCTL_DNX_WAIT_FENCE, &req))
+		return -errno;
+
+	return 0;
+}
+
+
+static void submitter_init(struct submitter *s, int fd, unsigned int nr_extra)
+{
+	dnx_stream_cmd_word_t cmd;
+	unsigned int i;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+
+	cmd.m_data = 0;
+	cmd.bits.m_cmd = DNX_STREAM_CMD_JMP;
+	cmd.bits.m_count = 1;
+
+	for(i = 0; i < STREAMS; i++) {
+		struct bo *bo = &s->streams[i].bo;
+
+		ret = bo_new(fd, STREAM_SIZE, DNX_BO_WC, bo);
+		if(!ret)
+			ret = bo_map(fd, bo);
+		if(ret)
+			die("stream bo", -ret);
+
+		/* the address is patched by the driver on each submit */
+		((volatile uint32_t *)bo->map)[0] = cmd.m_data;
+		((volatile uint32_t *)bo->map)[1] = 0;
+	}
+
+	for(i = 0; i < nr_extra; i++) {
+		ret = bo_new(fd, EXTRA_BO_SIZE, DNX_BO_WC, &s->extra[i]);
+		if(ret)
+			die("extra bo", -ret);
+	}
+	s->nr_extra = nr_extra;
+}
+
+
+static void submitter_fini(struct submitter *s)
+{
+	unsigned int i;
+
+	if(s->last && wait_fence(s->fd, s->last))
+		die("WAIT_FENCE", errno);
+
+	for(i = 0; i < STREAMS; i++)
+		bo_free(s->fd, &s->streams[i].bo);
+	for(i = 0; i < s->nr_extra; i++)
+		bo_free(s->fd, &s->extra[i]);
+}
+
+
+/* Submits the next stream with nr_bos bos, the stream's one included. */
+static uint32_t submit(struct submitter *s, unsigned int nr_bos)
+{
+	struct stream *stream = &s->streams[s->next++ % STREAMS];
+	struct drm_dnx_stream_submit_ext req = { 0 };
+	unsigned int i;
+	int ret;
+
+	if(stream->fence) {
+		ret = wait_fence(s->fd, stream->fence);
+		if(ret)
+			die("WAIT_FENCE", -ret);
+	}
+
+	/* read only, so the bos don't serialize the jobs */
+	s->bos[0].handle = stream->bo.handle;
+	s->bos[0].flags = DNX_SUBMIT_BO_READ;
+	for(i = 1; i < nr_bos; i++) {
+		s->bos[i].handle = s->extra[i - 1].handle;
+		s->bos[i].flags = DNX_SUBMIT_BO_READ;
+	}
+
+	req.stream = stream->bo.paddr;
+	req.jump = stream->bo.paddr + sizeof(uint32_t);
+	req.bos = (uintptr_t)s->bos;
+	req.nr_bos = nr_bos;
+	req.flags = DNX_SUBMIT_BO_FLAGS;
+	req.fence_fd = -1;
+
+	if(drmIoctl(s->fd, DRM_IOCTL_DNX_STREAM_SUBMIT_EXT, &req))
+		die("STREAM_SUBMIT_EXT", errno);
+
+	stream->fence = req.fence;
+	s->last = req.fence;
+
+	return req.fence;
+}
+
+
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static int64_t percentile(const int64_t *sorted, unsigned int nr, unsigned int per_mille)
+{
+	return sorted[(uint64_t)(nr - 1) * per_mille / 1000];
+}
+
+
+static void bench_gem(int fd)
+{
+	unsigned int c, s, i;
+	bool first = true;
+
+	printf("  \"gem\": [\n");
+
+	for(c = 0; c < sizeof(gem_cachings) / sizeof(gem_cachings[0]); c++) {
+		for(s = 0; s < sizeof(gem_sizes) / sizeof(gem_sizes[0]); s++) {
+			size_t size = gem_sizes[s];
+			unsigned int iters = opts.gem_iters;
+			int64_t t_new = 0, t_map = 0, t_close = 0, t;
+			struct bo bo;
+			int ret;
+
+			/* only bos of up to half a page are suballocated */
+			if((gem_cachings[c].flags & DNX_BO_SUBALLOC) && size > 2048)
+				continue;
+
+			if((uint64_t)iters * size > GEM_BYTES_MAX)
+				iters = GEM_BYTES_MAX / size;
+			if(!iters)
+				iters = 1;
+
+			for(i = 0; i < iters; i++) {
+				t = now_ns();
+				ret = bo_new(fd, size, gem_cachings[c].flags, &bo);
+				if(ret)
+					die("GEM_NEW", -ret);
+				t_new += now_ns() - t;
+
+				t = now_ns();
+				ret = bo_map(fd, &bo);
+				if(ret)
+					die("mmap", -ret);
+				/* fault in the first page */
+				*(volatile uint32_t *)bo.map = i;
+				t_map += now_ns() - t;
+
+				t = now_ns();
+				bo_free(fd, &bo);
+				t_close += now_ns() - t;
+			}
+
+			printf("%s    { \"caching\": \"%s\", \"size\": %zu, "
+					"\"iterations\": %u, \"new_ns\": %" PRId64 ", "
+					"\"mmap_ns\": %" PRId64 ", \"close_ns\": %" PRId64 ", "
+					"\"bos_per_s\": %.1f }",
+					first ? "" : ",\n", gem_cachings[c].name, size,
+					iters, t_new / iters, t_map / iters,
+					t_close / iters,
+					iters * 1e9 / (t_new + t_map + t_close));
+			first = false;
+		}
+	}
+
+	printf("\n  ],\n");
+}
+
+
+static void bench_submit(int fd)
+{
+	struct submitter *s = malloc(sizeof(*s));
+	unsigned int b, i;
+
+	if(!s)
+		die("malloc", ENOMEM);
+
+	submitter_init(s, fd, MAX_BOS - 1);
+
+	printf("  \"submit\": [\n");
+
+	for(b = 0; b < sizeof(submit_bos) / sizeof(submit_bos[0]); b++) {
+		unsigned int nr_bos = submit_bos[b];
+		int64_t t_ioctl = 0, start, t;
+		int ret;
+
+		start = now_ns();
+		for(i = 0; i < opts.submits; i++) {
+			t = now_ns();
+			submit(s, nr_bos);
+			t_ioctl += now_ns() - t;
+		}
+		ret = wait_fence(fd, s->last);
+		if(ret)
+			die("WAIT_FENCE", -ret);
+		t = now_ns() - start;
+
+		printf("%s    { \"nr_bos\": %u, \"submits\": %u, "
+				"\"submit_ns\": %" PRId64 ", \"submits_per_s\": %.1f }",
+				b ? ",\n" : "", nr_bos, opts.submits,
+				t_ioctl / opts.submits, opts.submits * 1e9 / t);
+	}
+
+	printf("\n  ],\n");
+
+	submitter_fini(s);
+	free(s);
+}
+
+
+static void bench_latency(int fd)
+{
+	struct submitter *s = malloc(sizeof(*s));
+	int64_t *samples = calloc(opts.samples, sizeof(*samples));
+	unsigned int i;
+	int64_t sum = 0;
+
+	if(!s || !samples)
+		die("malloc", ENOMEM);
+
+	submitter_init(s, fd, 0);
+
+	for(i = 0; i < opts.samples; i++) {
+		int64_t t = now_ns();
+		int ret;
+
+		ret = wait_fence(fd, submit(s, 1));
+		if(ret)
+			die("WAIT_FENCE", -ret);
+		samples[i] = now_ns() - t;
+		sum += samples[i];
+	}
+
+	qsort(samples, opts.samples, sizeof(*samples), cmp_i64);
+
+	printf("  \"latency\": { \"samples\": %u, \"mean_ns\": %" PRId64 ", "
+			"\"min_ns\": %" PRId64 ", \"p50_ns\": %" PRId64 ", "
+			"\"p90_ns\": %" PRId64 ", \"p99_ns\": %" PRId64 ", "
+			"\"p999_ns\": %" PRId64 ", \"max_ns\": %" PRId64 " },\n",
+			opts.samples, sum / opts.samples, samples[0],
+			percentile(samples, opts.samples, 500),
+			percentile(samples, opts.samples, 900),
+			percentile(samples, opts.samples, 990),
+			percentile(samples, opts.samples, 999),
+			samples[opts.samples - 1]);
+
+	submitter_fini(s);
+	free(samples);
+	free(s);
+}
+
+
+/* Submits until the deadline, returns the number of submits. The last
+ * fence is waited for, so the count is of completed jobs. */
+static uint64_t worker_run(struct submitter *s, int64_t deadline)
+{
+	uint64_t nr = 0;
+
+	while(now_ns() < deadline) {
+		submit(s, 1);
+		nr++;
+	}
+
+	if(s->last && wait_fence(s->fd, s->last))
+		die("WAIT_FENCE", errno);
+
+	return nr;
+}
+
+
+struct thread_arg {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	struct submitter s;
+	int64_t deadline;
+	uint64_t submits;
+	int64_t end;
+};
+
+static void *worker_thread(void *data)
+{
+	struct thread_arg *arg = data;
+
+	pthread_barrier_wait(arg->barrier);
+	arg->submits = worker_run(&arg->s, arg->deadline);
+	arg->end = now_ns();
+
+	return NULL;
+}
+
+
+static void scaling_threads(int fd, unsigned int nr, uint64_t *submits,
+		int64_t *elapsed)
+{
+	struct thread_arg *args = calloc(nr, sizeof(*args));
+	pthread_barrier_t barrier;
+	int64_t start, end = 0;
+	unsigned int i;
+
+	if(!args)
+		die("malloc", ENOMEM);
+
+	pthread_barrier_init(&barrier, NULL, nr + 1);
+
+	for(i = 0; i < nr; i++) {
+		submitter_init(&args[i].s, fd, 0);
+		args[i].barrier = &barrier;
+		if(pthread_create(&args[i].thread, NULL, worker_thread, &args[i]))
+			die("pthread_create", errno);
+	}
+
+	start = now_ns();
+	for(i = 0; i < nr; i++)
+		args[i].deadline = start + opts.duration_ms * 1000000LL;
+	pthread_barrier_wait(&barrier);
+
+	*submits = 0;
+	for(i = 0; i < nr; i++) {
+		pthread_join(args[i].thread, NULL);
+		*submits += args[i].submits;
+		if(args[i].end > end)
+			end = args[i].end;
+		submitter_fini(&args[i].s);
+	}
+	*elapsed = end - start;
+
+	pthread_barrier_destroy(&barrier);
+	free(args);
+}
+
+
+/* Each process opens the node itself. They start at the same time on a
+ * byte from the parent and report submits and end time through a pipe. */
+static void scaling_procs(unsigned int nr, uint64_t *submits, int64_t *elapsed)
+{
+	int go[2], ready[2], result[2];
+	int64_t start, end = 0;
+	unsigned int i;
+	pid_t pid;
+
+	if(pipe(go) || pipe(ready) || pipe(result))
+		die("pipe", errno);
+
+	for(i = 0; i < nr; i++) {
+		pid = fork();
+		if(pid < 0)
+			die("fork", errno);
+
+		if(!pid) {
+			struct submitter *s = malloc(sizeof(*s));
+			int64_t msg[2], deadline;
+			char path[64];
+			int fd;
+
+			fd = dnx_open(path, sizeof(path));
+			if(!s)
+				die("malloc", ENOMEM);
+			submitter_init(s, fd, 0);
+
+			if(write(ready[1], "r", 1) != 1 ||
+					read(go[0], &deadline, sizeof(deadline)) != sizeof(deadline))
+				_exit(1);
+
+			msg[0] = worker_run(s, deadline);
+			msg[1] = now_ns();
+			submitter_fini(s);
+
+			if(write(result[1], msg, sizeof(msg)) != sizeof(msg))
+				_exit(1);
+			_exit(0);
+		}
+	}
+
+	for(i = 0; i < nr; i++) {
+		char c;
+
+		if(read(ready[0], &c, 1) != 1)
+			die("worker setup", EPIPE);
+	}
+
+	start = now_ns();
+	for(i = 0; i < nr; i++) {
+		int64_t deadline = start + opts.duration_ms * 1000000LL;
+
+		if(write(go[1], &deadline, sizeof(deadline)) != sizeof(deadline))
+			die("start workers", errno);
+	}
+
+	*submits = 0;
+	for(i = 0; i < nr; i++) {
+		int64_t msg[2];
+
+		if(read(result[0], msg, sizeof(msg)) != sizeof(msg))
+			die("worker result", EPIPE);
+		*submits += msg[0];
+		if(msg[1] > end)
+			end = msg[1];
+	}
+	*elapsed = end - start;
+
+	while(wait(NULL) > 0)
+		;
+
+	close(go[0]);
+	close(go[1]);
+	close(ready[0]);
+	close(ready[1]);
+	close(result[0]);
+	close(result[1]);
+}
+
+
+static void bench_scaling(int fd)
+{
+	unsigned int mode, nr;
+
+	printf("  \"scaling\": [\n");
+
+	for(mode = 0; mode < 2; mode++) {
+		for(nr = 1; nr <= opts.workers; nr++) {
+			uint64_t submits;
+			int64_t elapsed;
+
+			/* the children must not inherit buffered output */
+			fflush(stdout);
+
+			if(!mode)
+				scaling_threads(fd, nr, &submits, &elapsed);
+			else
+				scaling_procs(nr, &submits, &elapsed);
+
+			printf("%s    { \"mode\": \"%s\", \"workers\": %u, "
+					"\"submits\": %" PRIu64 ", \"elapsed_ns\": %" PRId64 ", "
+					"\"submits_per_s\": %.1f }",
+					mode || nr > 1 ? ",\n" : "",
+					mode ? "processes" : "threads", nr, submits,
+					elapsed, submits * 1e9 / elapsed);
+		}
+	}
+
+	printf("\n  ],\n");
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: dnxbench [options] [gem] [submit] [latency] [scaling]\n"
+		"  -d path   render node (first one of " DNX_DRIVER_NAME ")\n"
+		"  -g num    GEM_NEW iterations per size (%u)\n"
+		"  -n num    submits per number of bos (%u)\n"
+		"  -l num    latency samples (%u)\n"
+		"  -j num    max. threads and processes, at most %u (%u)\n"
+		"  -t ms     duration per scaling step (%u)\n"
+		"all benchmarks run if none is given\n",
+		opts.gem_iters, opts.submits, opts.samples, MAX_WORKERS,
+		opts.workers, opts.duration_ms);
+	exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+	drmVersionPtr version;
+	char path[64];
+	int opt, fd, i;
+
+	while((opt = getopt(argc, argv, "d:g:n:l:j:t:")) != -1) {
+		switch(opt) {
+		case 'd':
+			opts.device = optarg;
+			break;
+		case 'g':
+			opts.gem_iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.submits = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			opts.samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			opts.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.duration_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if(!opts.gem_iters || !opts.submits || !opts.samples ||
+			!opts.workers || opts.workers > MAX_WORKERS ||
+			!opts.duration_ms)
+		usage();
+
+	for(i = optind; i < argc; i++) {
+		if(!strcmp(argv[i], "gem"))
+			opts.gem = true;
+		else if(!strcmp(argv[i], "submit"))
+			opts.submit = true;
+		else if(!strcmp(argv[i], "latency"))
+			opts.latency = true;
+		else if(!strcmp(argv[i], "scaling"))
+			opts.scaling = true;
+		else
+			usage();
+	}
+
+	if(optind == argc)
+		opts.gem = opts.submit = opts.latency = opts.scaling = true;
+
+	fd = dnx_open(path, sizeof(path));
+	version = drmGetVersion(fd);
+	if(!version)
+		die("drmGetVersion", errno);
+
+	printf("{\n  \"device\": \"%s\",\n"
+			"  \"driver\": { \"name\": \"%s\", \"version\": \"%d.%d.%d\", "
+			"\"date\": \"%s\" },\n",
+			path, version->name, version->version_major,
+			version->version_minor, version->version_patchlevel,
+			version->date);
+	drmFreeVersion(version);
+
+	if(opts.gem)
+		bench_gem(fd);
+	if(opts.submit)
+		bench_submit(fd);
+	if(opts.latency)
+		bench_latency(fd);
+	if(opts.scaling)
+		bench_scaling(fd);
+
+	printf("  \"timestamp\": %lld\n}\n", (long long)time(NULL));
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,808 @@
+/*
+ * Userspace harness for the ring of dnx_buffer.c. The driver's ring code is
+ * built against the headers in shim/ and driven by models of the stream
+ * controller (STC) and of the hard irq handler, which follow the core and
+ * dnx_drv.c. Scheduling and retiring follow dnx_gpu.c.
+ *
+ *   check   randomized property test, one thread interleaves submits, STC
+ *           commands, irqs and retiring
+ *   stress  the same with the STC, the irq handler and the submitter in
+ *           threads of their own, so restarts race with ring updates
+ *   bench   time stamp counter ticks spent per batch in
+ *           dnx_buffer_has_space() and dnx_buffer_queue_batch()
+ *
+ * Each stream writes its job number to SYNC_1 and jumps back into the ring.
+ * The STC model fails the run unless job numbers and sync ids arrive in
+ * order, each exactly once. Fences start close to 2^32 by default, so every
+ * run covers their wrap around.
+ */
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "dnx_buffer.h"
+#include "dnx_gem.h"
+#include "dnx_gpu.h"
+
+#include "nx_types.h"
+#include "nx_register_address.h"
+
+
+#define RING_BASE (0x10000000u)
+#define STREAM_BASE (0x40000000u)
+#define STREAM_DWORDS (4) /* sync_1 write (2), jump (2) */
+#define STREAM_SLOTS (4096) /* more than jobs in flight */
+#define REGS (DNX_REG_CONTROL_IRQ_TRIGGER + 1)
+
+#define FENCE_START (0xffffffffu - 5000)
+#define CHECK_JOBS (4000000)
+#define STRESS_JOBS (1000000)
+#define BENCH_ROUNDS (200000)
+#define DRAIN_STEPS (1000000) /* steps without progress until a ring is stuck */
+#define STRESS_TIMEOUT_S (10)
+
+
+/* a job's stream, it is the bo its cmdbuf patches the return jump into */
+struct job {
+	struct dnx_gem_object bo;
+	u32 stream[STREAM_DWORDS];
+	u32 nr;
+	struct dnx_cmdbuf cmdbuf; /* last, ends in the bos array */
+};
+
+static struct dnx_device dnx;
+static struct dnx_ringbuf ring;
+
+/* jobs [retired, submitted) are in flight, by nr % STREAM_SLOTS */
+static struct job *slots[STREAM_SLOTS];
+static u32 job_next;
+static u32 job_submitted; /* protected by the device's active_lock */
+static u32 job_retired;
+
+static u32 fence_first; /* last fence before the first job */
+static unsigned int window = DNX_SCHED_WINDOW_MAX;
+static u64 seed;
+
+static struct {
+	spinlock_t lock; /* registers and STC state */
+	u32 regs[REGS];
+	bool running;
+	u32 pc;
+	u32 job_next; /* expected in SYNC_1 */
+	u32 fence_next; /* expected in SYNC_0 */
+	unsigned long cmds;
+} stc;
+
+static volatile bool stop;
+
+
+static void fail(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+static void fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "FAIL: ");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	fprintf(stderr, "\nseed=%llu jobs=%u/%u/%u fence next=%u active=%u completed=%u\n"
+			"ring size=%u head=0x%x tail=0x%x stc=%s pc=0x%08x\n",
+			(unsigned long long)seed, job_retired, job_submitted, job_next,
+			dnx.fence_next, dnx.fence_active, dnx.fence_completed,
+			ring.size, ring.user_size, ring.tail,
+			stc.running ? "running" : "stopped", stc.pc);
+	exit(1);
+}
+
+
+/* xorshift64*, the STC thread draws from a state of its own */
+static u64 rnd_from(u64 *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dull;
+}
+
+
+static u64 rnd(void)
+{
+	return rnd_from(&seed);
+}
+
+
+static unsigned int rnd_range(unsigned int lo, unsigned int hi)
+{
+	return lo + rnd() % (hi - lo + 1);
+}
+
+
+static u32 next_fence(u32 fence)
+{
+	/* 0 marks fences that are not linked yet */
+	if(!++fence)
+		++fence;
+	return fence;
+}
+
+
+/* The driver's side of the registers */
+
+u32 dnx_reg_read(struct dnx_device *dnx, u32 reg)
+{
+	u32 val;
+
+	BUG_ON(reg >= REGS);
+
+	spin_lock(&stc.lock);
+	val = stc.regs[reg];
+	spin_unlock(&stc.lock);
+
+	return val;
+}
+
+
+void dnx_reg_write(struct dnx_device *dnx, u32 reg, u32 val)
+{
+	BUG_ON(reg >= REGS);
+
+	spin_lock(&stc.lock);
+	switch(reg) {
+	case DNX_REG_CONTROL_IRQ_STATE:
+		stc.regs[reg] &= ~val;
+		break;
+
+	case DNX_REG_CONTROL_STREAM_ADDR:
+		if(stc.running)
+			fail("STC started at 0x%08x while running at 0x%08x",
+					val, stc.pc);
+		stc.regs[reg] = val;
+		stc.regs[DNX_REG_CONTROL_STREAM_POS] = val;
+		stc.regs[DNX_REG_CONTROL_BUSY] |= DNX_BUSY_MASK_CTRL;
+		stc.pc = val;
+		stc.running = true;
+		break;
+
+	default:
+		stc.regs[reg] = val;
+		break;
+	}
+	spin_unlock(&stc.lock);
+}
+
+
+void dnx_gem_sync_for_device(struct dnx_gem_object *bo, size_t offset,
+		size_t size)
+{
+}
+
+
+/* STC model, caller holds stc.lock */
+
+static bool stc_fetch(u32 addr, u32 *word)
+{
+	u32 off = addr - STREAM_BASE;
+	struct job *job;
+
+	if(addr & (sizeof(u32) - 1))
+		return false;
+
+	if(addr - ring.paddr < ring.size) {
+		*word = READ_ONCE(((u32 *)ring.vaddr)[(addr - ring.paddr) / sizeof(u32)]);
+		return true;
+	}
+
+	if(off >= STREAM_SLOTS * sizeof(job->stream))
+		return false;
+
+	job = READ_ONCE(slots[off / sizeof(job->stream)]);
+	if(!job)
+		return false;
+
+	*word = READ_ONCE(job->stream[off % sizeof(job->stream) / sizeof(u32)]);
+	return true;
+}
+
+
+static void stc_write(u32 reg, u32 val)
+{
+	switch(reg) {
+	case DNX_REG_CONTROL_SYNC_1:
+		if(val != stc.job_next)
+			fail("job %u ran, expected job %u", val, stc.job_next);
+		stc.job_next++;
+		break;
+
+	case DNX_REG_CONTROL_SYNC_0:
+		if(val != stc.fence_next)
+			fail("sync %u written, expected %u", val, stc.fence_next);
+		stc.fence_next = next_fence(val);
+		stc.regs[DNX_REG_CONTROL_IRQ_STATE] |= DNX_IRQ_MASK_STREAM_SYNC;
+		break;
+
+	default:
+		fail("stream writes register %u", reg);
+	}
+
+	stc.regs[reg] = val;
+}
+
+
+/* Executes one command. Like the core, END stops at its own address. */
+static void stc_step(void)
+{
+	dnx_stream_cmd_word_t cmd;
+	u32 arg;
+
+	if(!stc_fetch(stc.pc, &cmd.m_data))
+		fail("STC fetch at 0x%08x", stc.pc);
+
+	switch(cmd.bits.m_cmd) {
+	case DNX_STREAM_CMD_END:
+		stc.running = false;
+		stc.regs[DNX_REG_CONTROL_BUSY] &= ~DNX_BUSY_MASK_CTRL;
+		stc.regs[DNX_REG_CONTROL_IRQ_STATE] |= DNX_IRQ_MASK_STREAM_DONE;
+		break;
+
+	case DNX_STREAM_CMD_JMP:
+		if(!stc_fetch(stc.pc + sizeof(u32), &arg))
+			fail("STC fetch of jump address at 0x%08x", stc.pc);
+		stc.pc = arg;
+		break;
+
+	case DNX_STREAM_CMD_WRITE:
+		if(cmd.bits.m_count != 1 ||
+				!stc_fetch(stc.pc + sizeof(u32), &arg))
+			fail("STC write command 0x%08x at 0x%08x",
+					cmd.m_data, stc.pc);
+		stc_write(cmd.bits.m_addr, arg);
+		stc.pc += 2 * sizeof(u32);
+		break;
+
+	default:
+		fail("STC command 0x%08x at 0x%08x", cmd.m_data, stc.pc);
+	}
+
+	stc.regs[DNX_REG_CONTROL_STREAM_POS] = stc.pc;
+	stc.cmds++;
+}
+
+
+/* Runs up to nr commands, returns false if the STC is stopped. */
+static bool stc_run(unsigned int nr)
+{
+	bool running;
+
+	spin_lock(&stc.lock);
+	while(nr-- && stc.running)
+		stc_step();
+	running = stc.running;
+	spin_unlock(&stc.lock);
+
+	return running;
+}
+
+
+/* Hard irq handler of dnx_drv.c for the stream irqs, returns false if none
+ * was pending. */
+static bool irq_handle(void)
+{
+	u32 stat = dnx_reg_read(&dnx, DNX_REG_CONTROL_IRQ_STATE);
+
+	if(!stat)
+		return false;
+
+	dnx_reg_write(&dnx, DNX_REG_CONTROL_IRQ_STATE, stat);
+
+	if(stat & DNX_IRQ_MASK_STREAM_SYNC)
+		WRITE_ONCE(dnx.fence_completed,
+				dnx_reg_read(&dnx, DNX_REG_CONTROL_SYNC_0));
+
+	if(stat & DNX_IRQ_MASK_STREAM_DONE) {
+		if(!dnx.stc_running)
+			fail("STREAM_DONE while the STC is not running");
+
+		spin_lock(&dnx.stc_lock);
+		if(dnx_stc_pending(&dnx)) {
+			u32 pos = dnx_reg_read(&dnx, DNX_REG_CONTROL_STREAM_POS);
+
+			dnx_reg_write(&dnx, DNX_REG_CONTROL_STREAM_ADDR, pos);
+			atomic_inc(&dnx.stats.stc_restarts);
+		}
+		else {
+			dnx.stc_running = false;
+		}
+		spin_unlock(&dnx.stc_lock);
+	}
+
+	return true;
+}
+
+
+/* Scheduler and retiring */
+
+static struct job *job_new(void)
+{
+	u32 slot = job_next % STREAM_SLOTS;
+	dnx_stream_cmd_word_t cmd;
+	struct job *job;
+
+	job = calloc(1, sizeof(*job));
+	if(!job)
+		fail("out of memory");
+
+	job->nr = job_next++;
+	job->bo.base.vaddr = job->stream;
+	job->bo.base.paddr = STREAM_BASE + slot * sizeof(job->stream);
+	job->bo.size = sizeof(job->stream);
+
+	cmd.m_data = 0;
+	cmd.bits.m_cmd = DNX_STREAM_CMD_WRITE;
+	cmd.bits.m_count = 1;
+	cmd.bits.m_addr = DNX_REG_CONTROL_SYNC_1;
+	job->stream[0] = cmd.m_data;
+	job->stream[1] = job->nr;
+
+	cmd.m_data = 0;
+	cmd.bits.m_cmd = DNX_STREAM_CMD_JMP;
+	cmd.bits.m_count = 1;
+	job->stream[2] = cmd.m_data;
+
+	job->cmdbuf.dnx = &dnx;
+	job->cmdbuf.paddr = job->bo.base.paddr;
+	job->cmdbuf.vjmpaddr = &job->stream[3];
+	job->cmdbuf.jmp_bo = &job->bo;
+
+	BUG_ON(slots[slot]);
+	WRITE_ONCE(slots[slot], job);
+
+	return job;
+}
+
+
+/* dnx_gpu_update_tail(), caller holds the device's active_lock */
+static void update_tail(void)
+{
+	u32 nr;
+
+	for(nr = job_retired; nr != job_submitted; nr++) {
+		struct job *job = slots[nr % STREAM_SLOTS];
+
+		if(!fence_completed(&dnx, job->cmdbuf.fence))
+			break;
+		dnx_buffer_consumed(&dnx, &job->cmdbuf);
+	}
+}
+
+
+/* dnx_sched_run_locked(), links up to want new jobs, returns how many */
+static unsigned int submit(unsigned int want)
+{
+	struct dnx_cmdbuf *batch[DNX_SCHED_WINDOW_MAX];
+	unsigned int inflight, room, i;
+
+	inflight = dnx.fence_next - READ_ONCE(dnx.fence_completed);
+	if(inflight >= window)
+		return 0;
+	room = min_t(unsigned int, window - inflight, want);
+	room = min_t(unsigned int, room,
+			STREAM_SLOTS - (job_next - READ_ONCE(job_retired)));
+
+	spin_lock_irq(&dnx.active_lock);
+	update_tail();
+	while(room && !dnx_buffer_has_space(&dnx, room))
+		room--;
+	spin_unlock_irq(&dnx.active_lock);
+
+	if(!room)
+		return 0;
+
+	for(i = 0; i < room; i++) {
+		batch[i] = &job_new()->cmdbuf;
+		dnx.fence_next = next_fence(dnx.fence_next);
+		batch[i]->fence = dnx.fence_next;
+	}
+
+	dnx_buffer_queue_batch(&dnx, batch, room);
+
+	spin_lock_irq(&dnx.active_lock);
+	job_submitted += room;
+	spin_unlock_irq(&dnx.active_lock);
+
+	return room;
+}
+
+
+/* dnx_gpu_retire(), frees the completed jobs */
+static void retire(void)
+{
+	spin_lock_irq(&dnx.active_lock);
+	while(job_retired != job_submitted) {
+		u32 slot = job_retired % STREAM_SLOTS;
+		struct job *job = slots[slot];
+
+		if(!fence_completed(&dnx, job->cmdbuf.fence))
+			break;
+
+		dnx_buffer_consumed(&dnx, &job->cmdbuf);
+		WRITE_ONCE(slots[slot], NULL);
+		free(job);
+		WRITE_ONCE(job_retired, job_retired + 1);
+	}
+	spin_unlock_irq(&dnx.active_lock);
+}
+
+
+static void check_ring(void)
+{
+	u32 space = dnx_buffer_space(&ring);
+
+	/* the head reaches the end before a reservation wraps around */
+	if(ring.user_size > ring.size || ring.tail >= ring.size ||
+			(ring.user_size | ring.tail) & (sizeof(u32) - 1))
+		fail("ring head 0x%x tail 0x%x out of bounds",
+				ring.user_size, ring.tail);
+
+	if(space > ring.size)
+		fail("ring space %u", space);
+}
+
+
+/* Runs the STC and the irqs until everything linked is retired. */
+static void drain(void)
+{
+	unsigned int steps = DRAIN_STEPS;
+
+	for(;;) {
+		bool busy = stc_run(1);
+
+		busy |= irq_handle();
+		retire();
+		if(!busy && job_retired == job_submitted)
+			break;
+		if(!--steps)
+			fail("ring stuck");
+	}
+
+	if(dnx.stc_running)
+		fail("STC considered running after draining");
+
+	/* a drained ring takes dnx_buffer_max_jobs() wherever its head is */
+	if(!dnx_buffer_has_space(&dnx, dnx_buffer_max_jobs(&ring)))
+		fail("drained ring is short of space for %u jobs",
+				dnx_buffer_max_jobs(&ring));
+}
+
+
+static void setup(u32 ring_size, u32 fence)
+{
+	memset(&dnx, 0, sizeof(dnx));
+	memset(&ring, 0, sizeof(ring));
+	memset(slots, 0, sizeof(slots));
+	memset(&stc, 0, sizeof(stc));
+	job_next = job_submitted = job_retired = 0;
+
+	spin_lock_init(&stc.lock);
+	spin_lock_init(&dnx.stc_lock);
+	spin_lock_init(&dnx.active_lock);
+
+	ring.dnx = &dnx;
+	ring.size = ring_size;
+	ring.paddr = RING_BASE;
+	ring.vaddr = calloc(1, ring_size);
+	if(!ring.vaddr)
+		fail("out of memory");
+
+	dnx.buffer = &ring;
+	dnx.ring_size = ring_size;
+	dnx.fence_next = fence;
+	dnx.fence_active = fence;
+	dnx.fence_completed = fence;
+	dnx.fence_retired = fence;
+	fence_first = fence;
+
+	stc.fence_next = next_fence(fence);
+
+	dnx_buffer_init(&dnx);
+}
+
+
+static void teardown(void)
+{
+	free(ring.vaddr);
+	ring.vaddr = NULL;
+}
+
+
+static void report(const char *mode, double secs)
+{
+	printf("%s: %u jobs in %.2fs, fences %u..%u, %d wraps, %d kicks, "
+			"%d restarts, %lu STC commands\n",
+			mode, job_retired, secs, next_fence(fence_first),
+			dnx.fence_completed, atomic_read(&dnx.stats.ring_wraps),
+			atomic_read(&dnx.stats.stc_kicks),
+			atomic_read(&dnx.stats.stc_restarts), stc.cmds);
+}
+
+
+static double now_s(void)
+{
+	return ktime_get() / 1e9;
+}
+
+
+/* fence_after() and fence_after_eq() against 64 bit sequence numbers */
+static void check_fence_order(unsigned long nr)
+{
+	while(nr--) {
+		u64 a = rnd() >> 2, b = a + rnd_range(0, INT32_MAX);
+
+		if(fence_after((u32)a, (u32)b) || !fence_after_eq((u32)b, (u32)a) ||
+				fence_after((u32)b, (u32)a) != (b != a))
+			fail("fence order of %llu and %llu",
+					(unsigned long long)a, (unsigned long long)b);
+	}
+}
+
+
+static void run_check(u32 ring_size, u32 fence, unsigned long jobs)
+{
+	double start = now_s();
+	unsigned int idle = 0;
+
+	check_fence_order(jobs);
+	setup(ring_size, fence);
+
+	while(job_next < jobs) {
+		unsigned int dice = rnd_range(0, 99);
+		u32 progress = job_next + stc.cmds;
+
+
+		if(dice < 30)
+			submit(rnd_range(1, window));
+		else if(dice < 80)
+			stc_run(rnd_range(1, 16));
+		else if(dice < 95)
+			irq_handle();
+		else
+			retire();
+
+		check_ring();
+
+		if(progress != job_next + stc.cmds)
+			idle = 0;
+		else if(++idle == DRAIN_STEPS)
+			fail("no progress");
+	}
+
+	drain();
+	check_ring();
+
+	if(stc.job_next != job_next)
+		fail("%u of %u jobs ran", stc.job_next, job_next);
+
+	report("check", now_s() - start);
+	teardown();
+}
+
+
+static void *stc_thread(void *data)
+{
+	u64 state = *(u64 *)data;
+
+	while(!stop) {
+		if(!stc_run(1 + rnd_from(&state) % 8))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+
+static void *irq_thread(void *data)
+{
+	while(!stop) {
+		if(!irq_handle())
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+
+static void run_stress(u32 ring_size, u32 fence, unsigned long jobs)
+{
+	pthread_t threads[2];
+	u64 stc_seed = rnd() | 1;
+	double start;
+
+	setup(ring_size, fence);
+	stop = false;
+
+	if(pthread_create(&threads[0], NULL, stc_thread, &stc_seed) ||
+			pthread_create(&threads[1], NULL, irq_thread, NULL))
+		fail("can't create threads");
+
+	start = now_s();
+	while(job_next < jobs) {
+		retire();
+		if(!submit(rnd_range(1, window)))
+			sched_yield();
+		if(now_s() - start > STRESS_TIMEOUT_S * (1 + jobs / STRESS_JOBS))
+			fail("no progress");
+	}
+
+	while(READ_ONCE(job_retired) != job_submitted) {
+		retire();
+		sched_yield();
+		if(now_s() - start > STRESS_TIMEOUT_S * (1 + jobs / STRESS_JOBS))
+			fail("ring stuck");
+	}
+
+	stop = true;
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+
+	drain();
+	check_ring();
+
+	if(stc.job_next != job_next)
+		fail("%u of %u jobs ran", stc.job_next, job_next);
+
+	report("stress", now_s() - start);
+	teardown();
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICKS "tsc ticks"
+#define ticks() __builtin_ia32_rdtsc()
+#else
+#define TICKS "ns"
+#define ticks() ((u64)ktime_get())
+#endif
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/* Ticks of a submit path that found its batch, the STC drains the ring in
+ * between unmeasured. */
+static void run_bench(u32 ring_size, u32 fence, unsigned long rounds)
+{
+	static const unsigned int sizes[] = { 1, 4, 8, 16, 32 };
+	struct dnx_cmdbuf *batch[DNX_SCHED_WINDOW_MAX];
+	u64 *samples;
+	unsigned int s, i;
+	unsigned long r;
+
+	samples = calloc(rounds, sizeof(*samples));
+	if(!samples)
+		fail("out of memory");
+
+	printf("bench: ring %u bytes, " TICKS " per batch of has_space + queue_batch\n",
+			ring_size);
+
+	for(s = 0; s < ARRAY_SIZE(sizes); s++) {
+		unsigned int nr = sizes[s];
+		u64 t;
+
+		setup(ring_size, fence);
+		if(nr > dnx_buffer_max_jobs(&ring) || nr > window) {
+			teardown();
+			break;
+		}
+
+		for(r = 0; r < rounds; r++) {
+			for(i = 0; i < nr; i++) {
+				batch[i] = &job_new()->cmdbuf;
+				dnx.fence_next = next_fence(dnx.fence_next);
+				batch[i]->fence = dnx.fence_next;
+			}
+
+			t = ticks();
+			spin_lock_irq(&dnx.active_lock);
+			update_tail();
+			if(!dnx_buffer_has_space(&dnx, nr))
+				fail("no ring space for %u jobs", nr);
+			spin_unlock_irq(&dnx.active_lock);
+			dnx_buffer_queue_batch(&dnx, batch, nr);
+			samples[r] = ticks() - t;
+
+			job_submitted += nr;
+			drain();
+		}
+
+		qsort(samples, rounds, sizeof(*samples), cmp_u64);
+		printf("  batch %2u: min %6llu  median %6llu  p99 %6llu  "
+				"median per job %6llu\n", nr,
+				(unsigned long long)samples[0],
+				(unsigned long long)samples[rounds / 2],
+				(unsigned long long)samples[rounds * 99 / 100],
+				(unsigned long long)samples[rounds / 2] / nr);
+
+		teardown();
+	}
+
+	free(samples);
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] check|stress|bench\n"
+		"  -n num    jobs (check %u, stress %u) or bench rounds (%u)\n"
+		"  -r bytes  ring size (%lu)\n"
+		"  -w num    jobs linked at once, at most %u (%u)\n"
+		"  -f fence  last fence before the first job (%u)\n"
+		"  -s seed   random seed (time)\n",
+		name, CHECK_JOBS, STRESS_JOBS, BENCH_ROUNDS,
+		DNX_RINGBUFFER_PAGES * PAGE_SIZE, DNX_SCHED_WINDOW_MAX,
+		DNX_SCHED_WINDOW_MAX, FENCE_START);
+	exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+	u32 ring_size = DNX_RINGBUFFER_PAGES * PAGE_SIZE;
+	u32 fence = FENCE_START;
+	unsigned long nr = 0;
+	const char *mode;
+	int opt;
+
+	seed = ktime_get();
+
+	while((opt = getopt(argc, argv, "n:r:w:f:s:")) != -1) {
+		switch(opt) {
+		case 'n':
+			nr = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ring_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fence = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(optind != argc - 1 || !window || window > DNX_SCHED_WINDOW_MAX ||
+			ring_size & (sizeof(u32) - 1) ||
+			ring_size < 3 * DNX_BUFFER_JOB_DWORDS * sizeof(u32))
+		usage(argv[0]);
+
+	mode = argv[optind];
+	printf("%s: seed %llu\n", mode, (unsigned long long)seed);
+	if(!seed)
+		seed = 1;
+
+	if(!strcmp(mode, "check"))
+		run_check(ring_size, fence, nr ? nr : CHECK_JOBS);
+	else if(!strcmp(mode, "stress"))
+		run_stress(ring_size, fence, nr ? nr : STRESS_JOBS);
+	else if(!strcmp(mode, "bench"))
+		run_bench(ring_size, fence, nr ? nr : BENCH_ROUNDS);
+	else
+		usage(argv[0]);
+
+	return 0;
+}
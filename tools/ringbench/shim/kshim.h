@@ -0,0 +1,300 @@
+#ifndef _KSHIM_H_
+#define _KSHIM_H_
+
+/*
+ * Just enough of the kernel API for building dnx_buffer.c and the headers it
+ * pulls in as a userspace program. Types only used by other parts of the
+ * driver are opaque placeholders. Locks are pthread spinlocks, so the ring
+ * can be driven from several threads like from the irq and a submitter.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+typedef int8_t __s8;
+typedef int16_t __s16;
+typedef int32_t __s32;
+typedef int64_t __s64;
+
+/* bus addresses of the core are 32 bit */
+typedef u32 dma_addr_t;
+typedef u32 phys_addr_t;
+typedef u32 resource_size_t;
+
+typedef s64 ktime_t;
+
+#define __iomem
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define mb() __sync_synchronize()
+#define rmb() __sync_synchronize()
+#define wmb() __sync_synchronize()
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() barrier()
+#endif
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define BUG_ON(cond) do { \
+	if(unlikely(cond)) { \
+		fprintf(stderr, "BUG at %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} \
+} while(0)
+
+#define WARN_ON(cond) ({ \
+	bool __c = !!(cond); \
+	if(unlikely(__c)) \
+		fprintf(stderr, "WARNING at %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+	__c; \
+})
+
+struct device;
+
+#define dev_dbg(dev, ...) do { } while(0)
+#define dev_info(dev, ...) fprintf(stderr, __VA_ARGS__)
+#define dev_warn(dev, ...) fprintf(stderr, __VA_ARGS__)
+#define dev_err(dev, ...) fprintf(stderr, __VA_ARGS__)
+
+#define PAGE_SIZE (4096UL)
+#define SZ_4K (0x1000)
+#define SZ_64K (0x10000)
+#define NSEC_PER_USEC (1000L)
+#define NSEC_PER_SEC (1000000000L)
+
+
+/* atomics */
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+	__atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+
+/* locks, interrupts are never disabled in userspace */
+
+typedef struct { pthread_spinlock_t lock; } spinlock_t;
+
+static inline void spin_lock_init(spinlock_t *l)
+{
+	pthread_spin_init(&l->lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+static inline void spin_lock(spinlock_t *l)
+{
+	pthread_spin_lock(&l->lock);
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+	pthread_spin_unlock(&l->lock);
+}
+
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_irqsave(l, flags) do { (flags) = 0; spin_lock(l); } while(0)
+#define spin_unlock_irqrestore(l, flags) do { (void)(flags); spin_unlock(l); } while(0)
+
+struct mutex { pthread_mutex_t lock; };
+
+static inline void mutex_init(struct mutex *m)
+{
+	pthread_mutex_init(&m->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *m)
+{
+	pthread_mutex_lock(&m->lock);
+}
+
+static inline void mutex_unlock(struct mutex *m)
+{
+	pthread_mutex_unlock(&m->lock);
+}
+
+
+/* lists */
+
+struct list_head { struct list_head *next, *prev; };
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+
+/* refcounts */
+
+struct kref { atomic_t refcount; };
+
+static inline void kref_init(struct kref *kref)
+{
+	atomic_set(&kref->refcount, 1);
+}
+
+static inline void kref_get(struct kref *kref)
+{
+	atomic_inc(&kref->refcount);
+}
+
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *kref))
+{
+	if(__atomic_sub_fetch(&kref->refcount.counter, 1, __ATOMIC_ACQ_REL))
+		return 0;
+	release(kref);
+	return 1;
+}
+
+
+/* time, jiffies stand still */
+
+#define HZ (100)
+#define INITIAL_JIFFIES (0UL)
+#define jiffies (0UL)
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+
+static inline unsigned long timespec_to_jiffies(const struct timespec *ts)
+{
+	return ts->tv_sec * HZ + ts->tv_nsec / (NSEC_PER_SEC / HZ);
+}
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ktime_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* placeholders of members the ring code never touches */
+
+struct rb_node { unsigned long __rb_parent_color; struct rb_node *rb_right, *rb_left; };
+struct rb_root { struct rb_node *rb_node; };
+struct interval_tree_node {
+	struct rb_node rb;
+	unsigned long start;
+	unsigned long last;
+	unsigned long __subtree_last;
+};
+
+typedef struct { spinlock_t lock; struct list_head task_list; } wait_queue_head_t;
+struct work_struct { void (*func)(struct work_struct *work); };
+struct workqueue_struct;
+struct timer_list { unsigned long expires; };
+struct idr { void *layer; };
+struct shrinker { unsigned long (*count_objects)(void); };
+struct reservation_object { void *fence; };
+struct seq_file;
+struct file;
+struct vm_area_struct;
+struct dma_buf;
+struct dma_buf_attachment;
+struct sg_table;
+
+static inline bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	return false;
+}
+
+struct fence {
+	struct kref refcount;
+	spinlock_t *lock;
+	u64 context;
+	unsigned int seqno;
+	unsigned long flags;
+};
+
+struct fence_cb {
+	struct list_head node;
+	void (*func)(struct fence *fence, struct fence_cb *cb);
+};
+
+
+/* drm */
+
+struct drm_event {
+	__u32 type;
+	__u32 length;
+};
+
+struct drm_file;
+
+struct drm_device {
+	struct device *dev;
+	void *dev_private;
+};
+
+struct drm_gem_object {
+	struct drm_device *dev;
+	size_t size;
+};
+
+struct drm_gem_cma_object {
+	struct drm_gem_object base;
+	dma_addr_t paddr;
+	struct sg_table *sgt;
+	void *vaddr;
+};
+
+#define to_drm_gem_cma_obj(gem_obj) \
+	container_of(gem_obj, struct drm_gem_cma_object, base)
+
+
+#endif /* _KSHIM_H_ */
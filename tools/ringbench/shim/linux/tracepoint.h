@@ -0,0 +1,15 @@
+#include "../kshim.h"
+
+#ifndef _KSHIM_TRACEPOINT_H_
+#define _KSHIM_TRACEPOINT_H_
+
+/* trace events compile to empty trace_x() calls */
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+	static inline void trace_##name(proto) {}
+
+#endif /* _KSHIM_TRACEPOINT_H_ */
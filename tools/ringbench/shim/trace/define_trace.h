@@ -0,0 +1 @@
+/* tracepoints are not created in userspace, see linux/tracepoint.h */